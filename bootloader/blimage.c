@@ -1,26 +1,142 @@
 /*
   create a image file for OTA update from txmain.bin
+
+  blimage      creates txmain.img
+  blimage -z   creates the compressed txmain.zimg
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <crc.h>
+#include <blimage.h>
 #include <arpa/inet.h>
 
-int main(void)
+/*
+  write the raw image
+ */
+static void write_image(int fd_out, const uint8_t *b, uint16_t size, uint32_t crc)
+{
+    uint32_t crc_swapped = htonl(crc);
+    uint16_t size_swapped = htons(size);
+
+    if (write(fd_out, &size_swapped, sizeof(size_swapped)) != sizeof(size_swapped) ||
+        write(fd_out, &crc_swapped, sizeof(crc_swapped)) != sizeof(crc_swapped) ||
+        write(fd_out, b, size) != size) {
+        printf("write failed\n");
+        exit(1);
+    }
+}
+
+/*
+  greedy LZ compression into the format described in blimage.h,
+  returning the compressed length
+ */
+static uint16_t lz_compress(const uint8_t *b, uint16_t size, uint8_t *out)
+{
+    uint16_t pos = 0;
+    uint16_t olen = 0;
+    uint16_t lit_start = 0;
+    uint16_t nlit = 0;
+
+    while (pos < size) {
+        uint16_t best_len = 0, best_dist = 0;
+        uint16_t dist;
+        for (dist=1; dist<=FW_LZ_WINDOW && dist<=pos; dist++) {
+            uint16_t len = 0;
+            while (len < FW_LZ_MAX_MATCH && pos+len < size &&
+                   b[pos+len] == b[pos-dist+len]) {
+                len++;
+            }
+            if (len > best_len) {
+                best_len = len;
+                best_dist = dist;
+            }
+        }
+        if (best_len >= FW_LZ_MIN_MATCH) {
+            if (nlit > 0) {
+                out[olen++] = nlit-1;
+                memcpy(&out[olen], &b[lit_start], nlit);
+                olen += nlit;
+                nlit = 0;
+            }
+            out[olen++] = 0x80 | ((best_len-FW_LZ_MIN_MATCH)<<3) | ((best_dist-1)>>8);
+            out[olen++] = (best_dist-1) & 0xFF;
+            pos += best_len;
+        } else {
+            if (nlit == 0) {
+                lit_start = pos;
+            }
+            nlit++;
+            pos++;
+            if (nlit == FW_LZ_MAX_LITERALS) {
+                out[olen++] = nlit-1;
+                memcpy(&out[olen], &b[lit_start], nlit);
+                olen += nlit;
+                nlit = 0;
+            }
+        }
+    }
+    if (nlit > 0) {
+        out[olen++] = nlit-1;
+        memcpy(&out[olen], &b[lit_start], nlit);
+        olen += nlit;
+    }
+    return olen;
+}
+
+/*
+  write the compressed image
+ */
+static void write_compressed_image(int fd_out, const uint8_t *b, uint16_t size, uint32_t crc)
 {
+    // worst case is all literals
+    uint8_t *z = malloc(size + size/FW_LZ_MAX_LITERALS + 1);
+    uint16_t zsize = lz_compress(b, size, z);
+    uint32_t zcrc = crc_crc32(z, zsize);
+    uint8_t hdr[FW_COMPRESSED_HEADER_LEN];
+
+    printf("compressed: %u (%u%%) zcrc:0x%08x\n", zsize, (unsigned)(zsize*100U/size), zcrc);
+
+    hdr[0] = FW_COMPRESSED_MAGIC >> 8;
+    hdr[1] = FW_COMPRESSED_MAGIC & 0xFF;
+    hdr[2] = zcrc >> 24;
+    hdr[3] = zcrc >> 16;
+    hdr[4] = zcrc >> 8;
+    hdr[5] = zcrc;
+    hdr[6] = zsize >> 8;
+    hdr[7] = zsize;
+    hdr[8] = size >> 8;
+    hdr[9] = size;
+    hdr[10] = crc >> 24;
+    hdr[11] = crc >> 16;
+    hdr[12] = crc >> 8;
+    hdr[13] = crc;
+
+    if (write(fd_out, hdr, sizeof(hdr)) != sizeof(hdr) ||
+        write(fd_out, z, zsize) != zsize) {
+        printf("write failed\n");
+        exit(1);
+    }
+    free(z);
+}
+
+int main(int argc, const char *argv[])
+{
+    int compress = (argc > 1 && strcmp(argv[1], "-z") == 0);
+    const char *out_name = compress ? "txmain.zimg" : "txmain.img";
     int fd_in = open("txmain.bin", O_RDONLY);
-    int fd_out = open("txmain.img", O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    int fd_out = open(out_name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
     if (fd_in == -1) {
         printf("failed to open txmain.bin\n");
         exit(1);
     }
     if (fd_out == -1) {
-        printf("failed to open txmain.img\n");
+        printf("failed to open %s\n", out_name);
         exit(1);
     }
 
@@ -36,14 +152,10 @@ int main(void)
     uint32_t crc = crc_crc32(b, size);
     printf("size: %u crc:0x%08x\n", size, crc);
 
-    uint32_t crc_swapped = htonl(crc);
-    uint16_t size_swapped = htons(size);
-
-    if (write(fd_out, &size_swapped, sizeof(size_swapped)) != sizeof(size_swapped) ||
-        write(fd_out, &crc_swapped, sizeof(crc_swapped)) != sizeof(crc_swapped) ||
-        write(fd_out, b, size) != size) {
-        printf("write failed\n");
-        exit(1);
+    if (compress) {
+        write_compressed_image(fd_out, b, size, crc);
+    } else {
+        write_image(fd_out, b, size, crc);
     }
     close(fd_in);
     close(fd_out);
@@ -3,12 +3,15 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include "stm8l.h"
 #include "config.h"
 #include "gpio.h"
 #include "crc.h"
 #include "eeprom.h"
+#include "blimage.h"
+#include "flash.h"
 
 #pragma noiv
 
@@ -83,35 +86,193 @@ static void toggle_code(uint8_t n)
 }
 
 /*
-  copy in flash memory
+  copy in flash memory, a block at a time via a RAM buffer. The
+  destination must be block aligned
  */
+static uint8_t block[FLASH_BLOCK_SIZE];
+
 static void flash_copy(uint16_t to, uint16_t from, uint16_t size)
 {
-    uint32_t *ptr1 = (uint32_t *)to;
-    const uint32_t *ptr2 = (const uint32_t *)from;
-    uint16_t nwords = (size+3) >> 2;
+    uint16_t nblocks = (size+FLASH_BLOCK_SIZE-1) / FLASH_BLOCK_SIZE;
 
-    progmem_unlock();
-    // copy using word mode, takes 14 seconds for 11k
+    // copy using block mode, about 6ms per 128 byte block
     gpio_clear(LED_YELLOW);
     gpio_set(LED_GREEN);
 
-    while (nwords--) {
-        FLASH_CR2 |= 0x40;
-        FLASH_NCR2 &= ~0x40;
+    while (nblocks--) {
+        memcpy(block, (const uint8_t *)from, FLASH_BLOCK_SIZE);
+        flash_write_block(to, block);
+        to += FLASH_BLOCK_SIZE;
+        from += FLASH_BLOCK_SIZE;
+
+        gpio_toggle(LED_YELLOW);
+        gpio_toggle(LED_GREEN);
+    }
+    gpio_set(LED_GREEN);
+    gpio_set(LED_YELLOW);
+}
+
 
-        *ptr1++ = *ptr2++;
+/*
+  the header of the image last applied, or found to be running
+  already, is kept in EEPROM with an inverted crc8 check byte. While
+  the new firmware slot holds an image with that header there is
+  nothing to do, so a normal boot skips the CRCs of both images. A new
+  image has a new header, so it is still checked and applied
+ */
+static bool image_applied(void)
+{
+    const uint8_t *hdr = (const uint8_t *)NEW_FIRMWARE_BASE;
+    uint8_t i;
 
-        if (nwords % 64 == 0) {
-            gpio_toggle(LED_YELLOW);
-            gpio_toggle(LED_GREEN);
+    for (i=0; i<FW_HEADER_LEN; i++) {
+        if (eeprom_read(EEPROM_FW_APPLIED_OFFSET+i) != hdr[i]) {
+            return false;
         }
     }
+    return eeprom_read(EEPROM_FW_APPLIED_OFFSET+FW_HEADER_LEN) == (uint8_t)~crc_crc8(hdr, FW_HEADER_LEN);
+}
+
+static void set_image_applied(void)
+{
+    const uint8_t *hdr = (const uint8_t *)NEW_FIRMWARE_BASE;
+    uint8_t check = ~crc_crc8(hdr, FW_HEADER_LEN);
+    uint8_t i;
+
+    // invalidate first, so a write cut short can't pass the check
+    eeprom_write(EEPROM_FW_APPLIED_OFFSET+FW_HEADER_LEN, ~check);
+    for (i=0; i<FW_HEADER_LEN; i++) {
+        eeprom_write(EEPROM_FW_APPLIED_OFFSET+i, hdr[i]);
+    }
+    eeprom_write(EEPROM_FW_APPLIED_OFFSET+FW_HEADER_LEN, check);
+}
+
+/*
+  copy only the blocks that differ from the running firmware. Both
+  images are memory mapped, so they are compared directly
+ */
+static void flash_copy_changed(uint16_t new_size)
+{
+    uint16_t ofs;
+
+    for (ofs=0; ofs < new_size; ofs += FW_BLOCK_SIZE) {
+        uint16_t len = new_size - ofs;
+        if (len > FW_BLOCK_SIZE) {
+            len = FW_BLOCK_SIZE;
+        }
+        if (memcmp((const uint8_t *)(CODELOC+ofs), (const uint8_t *)(NEW_FIRMWARE_BASE+FW_HEADER_LEN+ofs), len) != 0) {
+            flash_copy(CODELOC+ofs, NEW_FIRMWARE_BASE+FW_HEADER_LEN+ofs, len);
+        }
+    }
+}
+
+/*
+  program the decompression block buffer at an offset in the main
+  firmware, if it has changed
+ */
+static void lz_flush(uint16_t ofs)
+{
+    if (memcmp((const uint8_t *)(CODELOC+ofs), block, FLASH_BLOCK_SIZE) != 0) {
+        flash_write_block(CODELOC+ofs, block);
+    }
+    gpio_toggle(LED_YELLOW);
+    gpio_toggle(LED_GREEN);
+}
+
+/*
+  decompress an image into the main firmware a block at a time. Match
+  sources are read from the block buffer, or from the flash already
+  written for earlier blocks
+ */
+static bool lz_decompress(const uint8_t *in, uint16_t zsize, uint16_t size)
+{
+    const uint8_t *in_end = in + zsize;
+    uint16_t out = 0;
+
+    gpio_clear(LED_YELLOW);
+    gpio_set(LED_GREEN);
+
+    while (in < in_end) {
+        uint8_t c = *in++;
+        uint8_t n;
+        uint16_t dist = 0;
+        if (c & 0x80) {
+            n = ((c >> 3) & 0x0F) + FW_LZ_MIN_MATCH;
+            dist = ((((uint16_t)(c & 0x07)) << 8) | *in++) + 1;
+            if (dist > out) {
+                return false;
+            }
+        } else {
+            n = c + 1;
+        }
+        if (out + n > size) {
+            return false;
+        }
+        while (n--) {
+            uint8_t b;
+            if (dist == 0) {
+                b = *in++;
+            } else {
+                uint16_t pos = out - dist;
+                if (pos >= (out & ~(FLASH_BLOCK_SIZE-1))) {
+                    b = block[pos & (FLASH_BLOCK_SIZE-1)];
+                } else {
+                    b = *(const uint8_t *)(CODELOC+pos);
+                }
+            }
+            block[out & (FLASH_BLOCK_SIZE-1)] = b;
+            out++;
+            if ((out & (FLASH_BLOCK_SIZE-1)) == 0) {
+                lz_flush(out - FLASH_BLOCK_SIZE);
+            }
+        }
+    }
+    if (out & (FLASH_BLOCK_SIZE-1)) {
+        lz_flush(out & ~(FLASH_BLOCK_SIZE-1));
+    }
     gpio_set(LED_GREEN);
     gpio_set(LED_YELLOW);
-    progmem_lock();
+    return out == size;
 }
 
+/*
+  check for a compressed firmware update
+ */
+static void check_compressed_firmware(void)
+{
+    uint32_t zcrc = *(uint32_t *)(NEW_FIRMWARE_BASE+2);
+    uint16_t zsize = *(uint16_t *)(NEW_FIRMWARE_BASE+6);
+    uint16_t new_size = *(uint16_t *)(NEW_FIRMWARE_BASE+8);
+    uint32_t new_crc = *(uint32_t *)(NEW_FIRMWARE_BASE+10);
+    const uint8_t *zdata = (const uint8_t *)(NEW_FIRMWARE_BASE+FW_COMPRESSED_HEADER_LEN);
+
+    if (new_size < 0x1000 || new_size > (NEW_FIRMWARE_BASE-CODELOC) ||
+        zsize > 0x10000UL-FW_COMPRESSED_HEADER_LEN-NEW_FIRMWARE_BASE) {
+        toggle_code(5);
+        return;
+    }
+    if (crc_crc32(zdata, zsize) != zcrc) {
+        toggle_code(6);
+        return;
+    }
+    if (crc_crc32((const uint8_t *)CODELOC, new_size) == new_crc) {
+        set_image_applied();
+        toggle_code(7);
+        return;
+    }
+
+    toggle_code(8);
+
+    // the output crc is checked from flash, so a bad stream is caught too
+    if (lz_decompress(zdata, zsize, new_size) &&
+        crc_crc32((const uint8_t *)CODELOC, new_size) == new_crc) {
+        set_image_applied();
+        toggle_code(9);
+        return;
+    }
+
+    toggle_code(10);
+}
 
 /*
   check for firmware update
@@ -122,6 +283,16 @@ static void check_new_firmware(void)
     uint32_t new_crc = *(int32_t *)(NEW_FIRMWARE_BASE+2);
     uint32_t calc_crc, calc_crc2, calc_crc3;
 
+    if (image_applied()) {
+        toggle_code(4);
+        return;
+    }
+
+    if (new_size == FW_COMPRESSED_MAGIC) {
+        check_compressed_firmware();
+        return;
+    }
+
     if (new_size < 0x1000 || new_size > (NEW_FIRMWARE_BASE-CODELOC)) {
         toggle_code(5);
         // not valid
@@ -134,16 +305,23 @@ static void check_new_firmware(void)
     }
     calc_crc2 = crc_crc32((const uint8_t *)CODELOC, new_size);
     if (calc_crc2 == calc_crc) {
+        set_image_applied();
         toggle_code(7);
         return;
     }
 
     toggle_code(8);
 
-    flash_copy(CODELOC, NEW_FIRMWARE_BASE+6, new_size);
+    flash_copy_changed(new_size);
 
     calc_crc3 = crc_crc32((const uint8_t *)CODELOC, new_size);
+    if (new_crc != calc_crc3) {
+        // rewrite all of it before giving up
+        flash_copy(CODELOC, NEW_FIRMWARE_BASE+6, new_size);
+        calc_crc3 = crc_crc32((const uint8_t *)CODELOC, new_size);
+    }
     if (new_crc == calc_crc3) {
+        set_image_applied();
         toggle_code(9);
         return;
     }
@@ -0,0 +1,169 @@
+/*
+  load txmain.img into the new firmware slot over the UART. Hold the
+  right shoulder button at power on to start the loader on the
+  transmitter
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <crc.h>
+#include <uartfw.h>
+
+#define MAX_RETRIES 10
+#define REPLY_TIMEOUT_MS 1000
+
+static int open_serial(const char *path)
+{
+    int fd = open(path, O_RDWR|O_NOCTTY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct termios t;
+    if (tcgetattr(fd, &t) != 0) {
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&t);
+    cfsetispeed(&t, B115200);
+    cfsetospeed(&t, B115200);
+    t.c_cflag |= CLOCAL | CREAD;
+    t.c_cc[VMIN] = 0;
+    t.c_cc[VTIME] = 0;
+    if (tcsetattr(fd, TCSANOW, &t) != 0) {
+        close(fd);
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+static int read_byte(int fd, uint8_t *c, int timeout_ms)
+{
+    fd_set fds;
+    struct timeval tv;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    if (select(fd+1, &fds, NULL, NULL, &tv) != 1) {
+        return 0;
+    }
+    return read(fd, c, 1) == 1;
+}
+
+/*
+  wait for the reply to a frame, returning the status or -1 on
+  timeout. Replies for other offsets (e.g. a NAK for line noise) are
+  skipped
+ */
+static int wait_reply(int fd, uint16_t offset)
+{
+    uint8_t c;
+    while (read_byte(fd, &c, REPLY_TIMEOUT_MS)) {
+        if (c != UARTFW_SYNC1) {
+            continue;
+        }
+        uint8_t r[4];
+        int i;
+        for (i=0; i<4; i++) {
+            if (!read_byte(fd, &r[i], REPLY_TIMEOUT_MS)) {
+                return -1;
+            }
+        }
+        if (r[0] != UARTFW_SYNC2) {
+            continue;
+        }
+        if (((r[2]<<8) | r[3]) != offset) {
+            continue;
+        }
+        return r[1];
+    }
+    return -1;
+}
+
+static int send_frame(int fd, uint16_t offset, const uint8_t *data, uint8_t len)
+{
+    uint8_t frame[UARTFW_HEADER_LEN + UARTFW_BLOCK_SIZE + 1];
+    frame[0] = UARTFW_SYNC1;
+    frame[1] = UARTFW_SYNC2;
+    frame[2] = offset >> 8;
+    frame[3] = offset & 0xFF;
+    frame[4] = len;
+    memcpy(&frame[5], data, len);
+    frame[5+len] = crc_crc8(&frame[2], 3+len);
+
+    int retry;
+    for (retry=0; retry<MAX_RETRIES; retry++) {
+        tcflush(fd, TCIFLUSH);
+        if (write(fd, frame, 6+len) != 6+len) {
+            return -1;
+        }
+        if (wait_reply(fd, offset) == UARTFW_ACK) {
+            return 0;
+        }
+        printf("retry at offset %u\n", (unsigned)offset);
+    }
+    return -1;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 2 || argc > 3) {
+        printf("Usage: uartload SERIALPORT [txmain.img]\n");
+        exit(1);
+    }
+    const char *img = argc > 2 ? argv[2] : "txmain.img";
+    int fd_in = open(img, O_RDONLY);
+    if (fd_in == -1) {
+        printf("failed to open %s\n", img);
+        exit(1);
+    }
+    struct stat st;
+    fstat(fd_in, &st);
+    if (st.st_size > 16*1024) {
+        printf("%s is too large\n", img);
+        exit(1);
+    }
+    uint16_t size = st.st_size;
+    uint8_t *b = malloc(size);
+    if (read(fd_in, b, size) != size) {
+        printf("Failed to read %u bytes\n", (unsigned)size);
+        exit(1);
+    }
+    close(fd_in);
+
+    int fd = open_serial(argv[1]);
+    if (fd == -1) {
+        printf("failed to open %s\n", argv[1]);
+        exit(1);
+    }
+
+    uint16_t offset;
+    for (offset=0; offset<size; offset += UARTFW_BLOCK_SIZE) {
+        uint16_t len = size - offset;
+        if (len > UARTFW_BLOCK_SIZE) {
+            len = UARTFW_BLOCK_SIZE;
+        }
+        if (send_frame(fd, offset, &b[offset], len) != 0) {
+            printf("failed at offset %u\n", (unsigned)offset);
+            exit(1);
+        }
+        printf("\r%u/%u", (unsigned)(offset+len), (unsigned)size);
+        fflush(stdout);
+    }
+    printf("\n");
+    if (send_frame(fd, size, NULL, 0) != 0) {
+        printf("image check failed\n");
+        exit(1);
+    }
+    printf("load complete\n");
+    close(fd);
+    return 0;
+}
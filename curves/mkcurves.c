@@ -0,0 +1,90 @@
+/*
+  generate the EEPROM image of the stick curve tables from a list of
+  expo and rate settings, so the transmitter only has to interpolate
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <channels.h>
+
+#define MAX_LINE 256
+
+/*
+  one curve point. The curve gives a stick value centred on 500, which
+  is rounded and then scaled with the same integer expression as the
+  firmware, so expo 0 rate 100 gives the original linear mapping
+ */
+static uint16_t curve_point(unsigned i, double expo, double rate)
+{
+    double x = ((double)(i * CURVE_STEP) - 500) / 500;
+    double y = rate * (expo * x * x * x + (1 - expo) * x);
+    double s = y * 500 + 500;
+    int16_t v = CURVE_LINEAR((int16_t)(s < 0 ? s - 0.5 : s + 0.5));
+    if (v < 0) {
+        v = 0;
+    }
+    if (v > 2047) {
+        v = 2047;
+    }
+    return (uint16_t)v;
+}
+
+int main(int argc, const char *argv[])
+{
+    FILE *f_in, *f_out;
+    char line[MAX_LINE];
+    unsigned num_axes = 0;
+    unsigned i;
+
+    if (argc != 3) {
+        printf("Usage: mkcurves CURVES.txt OUTPUT.bin\n");
+        exit(1);
+    }
+    f_in = fopen(argv[1], "r");
+    if (f_in == NULL) {
+        printf("failed to open %s\n", argv[1]);
+        exit(1);
+    }
+    f_out = fopen(argv[2], "wb");
+    if (f_out == NULL) {
+        printf("failed to open %s\n", argv[2]);
+        exit(1);
+    }
+
+    fputc(CURVE_MAGIC, f_out);
+
+    while (fgets(line, sizeof(line), f_in) != NULL) {
+        char name[MAX_LINE];
+        unsigned expo, rate;
+
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == '#' || line[0] == 0) {
+            continue;
+        }
+        if (sscanf(line, "%s %u %u", name, &expo, &rate) != 3 ||
+            expo > 100 || rate > 200 || num_axes == CURVE_NUM_AXES) {
+            printf("bad curve '%s'\n", line);
+            exit(1);
+        }
+        printf("%s:", name);
+        for (i=0; i<CURVE_POINTS; i++) {
+            uint16_t v = curve_point(i, expo*0.01, rate*0.01);
+            // big-endian, as read by the STM8
+            fputc(v >> 8, f_out);
+            fputc(v & 0xFF, f_out);
+            printf(" %u", v);
+        }
+        printf("\n");
+        num_axes++;
+    }
+    if (num_axes != CURVE_NUM_AXES) {
+        printf("need %u curves, got %u\n", CURVE_NUM_AXES, num_axes);
+        exit(1);
+    }
+
+    fclose(f_in);
+    fclose(f_out);
+    return 0;
+}
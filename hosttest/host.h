@@ -0,0 +1,9 @@
+/*
+  forced include for the host build of the lib/ sources. The new
+  firmware slot is a RAM array in the host, see mock.c
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+extern uint8_t host_fw_slot[];
+#define NEW_FIRMWARE_BASE ((uintptr_t)host_fw_slot)
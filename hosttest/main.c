@@ -0,0 +1,627 @@
+/*
+  host regression and benchmark harness for the lib/ hot paths
+
+  Runs the packet builder, telemetry decoder, channel mapping and
+  RTTTL parser against the mocks in mock.c. Results that must not
+  change, including the SPI and register traffic of each packet, are
+  checked against a golden file:
+    hosttest golden.txt     check against the golden file
+    hosttest -u golden.txt  rewrite the golden file
+    hosttest -v ...         also show the firmware's printf output
+  The wall clock timings printed at the end are not checked
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <channels.h>
+#include <cypress.h>
+#include <crc.h>
+#include <rtttl.h>
+#include <eeprom.h>
+#include <adc.h>
+#include <settings.h>
+#include <buttons.h>
+#include <gpio.h>
+#include <config.h>
+#include <telem_structure.h>
+#include "mock.h"
+
+// provided by cypress.c
+extern struct telem_status t_status;
+extern uint8_t telem_ack_value;
+
+static FILE *golden_file;
+static bool update;
+static unsigned golden_lines;
+static unsigned failures;
+
+/*
+  add a line of golden output, comparing it against the golden file
+  or writing it out
+ */
+static void golden(const char *fmt, ...)
+{
+    char line[256];
+    char expected[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    golden_lines++;
+
+    if (update) {
+        fprintf(golden_file, "%s\n", line);
+        return;
+    }
+    if (fgets(expected, sizeof(expected), golden_file) == NULL) {
+        expected[0] = 0;
+    }
+    expected[strcspn(expected, "\n")] = 0;
+    if (strcmp(line, expected) != 0) {
+        printf("golden line %u differs\n  expected: %s\n  got:      %s\n",
+               golden_lines, expected, line);
+        failures++;
+    }
+}
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+/*
+  a powered up transmitter with centred sticks and a little noise on
+  some channels
+ */
+static void setup(void)
+{
+    uint8_t i;
+
+    host_reset();
+    memset(host_eeprom, 0, sizeof(host_eeprom));
+    memset(host_fw_slot, 0xFF, sizeof(host_fw_slot));
+    host_eeprom[EEPROM_WIFICHAN_OFFSET] = 6;
+    for (i=0; i<sizeof(host_rssi); i++) {
+        host_rssi[i] = (i * 7) % 11;
+    }
+    for (i=0; i<4; i++) {
+        host_adc[i] = 512;
+    }
+    host_adc[STICK_THROTTLE] = 100;
+
+    settings_init();
+    channels_init();
+    cypress_init();
+}
+
+/*
+  run until the radio has sent another packet
+ */
+static bool run_to_next_packet(void)
+{
+    uint8_t n = host_num_packets;
+    uint16_t i;
+    for (i=0; i<1000 && host_num_packets == n; i++) {
+        host_run_us(100);
+    }
+    return host_num_packets != n;
+}
+
+static void print_packet(uint8_t idx, const struct host_packet *p)
+{
+    char hex[33];
+    uint8_t i;
+    for (i=0; i<16; i++) {
+        sprintf(&hex[i*2], "%02x", p->data[i]);
+    }
+    golden("PKT %02u ch=%u seed=%04x sop=%02x%02x data=%s go=%u spi=%u bytes=%u rd=%u wr=%u q=%u gpio=%u adc=%u tmr=%u",
+           idx, p->channel, p->crc_seed, p->sop_code[0], p->sop_code[1], hex, p->go_us,
+           host_counts.spi_transactions, host_counts.spi_bytes,
+           host_counts.reg_reads, host_counts.reg_writes,
+           host_counts.queued_writes, host_counts.gpio_accesses,
+           host_counts.adc_reads, host_counts.timer_calls);
+}
+
+/*
+  the packets of the first frames after starting to send, and the
+  radio traffic between each packet and the one before it
+ */
+static void test_packets(void)
+{
+    uint8_t i;
+
+    setup();
+    host_reset_counts();
+    cypress_start_send(true);
+    golden("START spi=%u bytes=%u rd=%u wr=%u", host_counts.spi_transactions,
+           host_counts.spi_bytes, host_counts.reg_reads, host_counts.reg_writes);
+
+    host_num_packets = 0;
+    for (i=0; i<16; i++) {
+        host_reset_counts();
+        if (!run_to_next_packet()) {
+            check(false, "packet sent");
+            return;
+        }
+        print_packet(i, &host_packets[host_num_packets-1]);
+        if (host_num_packets == HOST_MAX_PACKETS) {
+            host_num_packets = 0;
+        }
+    }
+}
+
+/*
+  time and SPI traffic of a DSM2 start, from the given EEPROM contents
+  and with a channel made noisier than the rest. Returns the SPI bytes
+  of the start
+ */
+static uint32_t chanplan_start(const char *name, const uint8_t *eeprom, uint8_t noisy_chan)
+{
+    uint32_t t0, bytes;
+
+    setup();
+    if (eeprom != NULL) {
+        memcpy(host_eeprom, eeprom, sizeof(host_eeprom));
+        settings_init();
+    }
+    host_rssi[noisy_chan] += 2;
+    host_reset_counts();
+    t0 = host_time_us;
+    cypress_start_send(true);
+    golden("CHANPLAN %s us=%lu spi=%u bytes=%u nf=%u,%u", name, (unsigned long)(host_time_us - t0),
+           host_counts.spi_transactions, host_counts.spi_bytes,
+           get_noise_floor(0), get_noise_floor(1));
+    bytes = host_counts.spi_bytes;
+    check(run_to_next_packet(), "chanplan packet sent");
+    return bytes;
+}
+
+/*
+  the channel pair of a full scan is reused at the next boot, unless
+  one of its channels has got noisier
+ */
+static void test_chanplan(void)
+{
+    static uint8_t cached[sizeof(host_eeprom)];
+    uint8_t *rec = &cached[EEPROM_CHAN_CACHE_OFFSET];
+    uint32_t scan_bytes;
+
+    // channel 0 is never scanned
+    scan_bytes = chanplan_start("scan", NULL, 0);
+    memcpy(cached, host_eeprom, sizeof(cached));
+    golden("CHANPLAN cached %u,%u rssi=%u,%u", rec[0], rec[1], rec[2], rec[3]);
+
+    check(chanplan_start("reuse", cached, 0) < scan_bytes, "cached pair used without a scan");
+
+    chanplan_start("noisy", cached, rec[1]);
+}
+
+/*
+  the DSMX hop sequence from dsm_generate_channels_dsmx(), and the SOP
+  code and CRC seed each hop gets from the hop plan
+ */
+static void test_dsmx(void)
+{
+    char chans[100], codes[150], seeds[30];
+    uint8_t i;
+
+    setup();
+    cypress_start_send(false);
+    host_num_packets = 0;
+    chans[0] = codes[0] = 0;
+    for (i=0; i<24; i++) {
+        const struct host_packet *p;
+        if (!run_to_next_packet()) {
+            check(false, "dsmx packet sent");
+            return;
+        }
+        p = &host_packets[host_num_packets-1];
+        check(p->channel >= 3 && p->channel <= 76, "dsmx channel range");
+        sprintf(&chans[strlen(chans)], " %u", p->channel);
+        sprintf(&codes[strlen(codes)], " %02x%02x", p->sop_code[0], p->sop_code[1]);
+        // the seed is complemented on alternate packets
+        seeds[i] = (p->crc_seed == host_packets[0].crc_seed) ? '0' : '1';
+    }
+    seeds[i] = 0;
+    golden("DSMX ch%s", chans);
+    golden("DSMX sop%s seed=%04x/%s", codes, host_packets[0].crc_seed, seeds);
+}
+
+/*
+  decode the uplink record in channel ids 8 to 10 of a packet, as the
+  receiver does. Returns false if the packet has none or its crc fails
+ */
+static bool decode_record(const struct host_packet *p, uint8_t *type, uint16_t *data)
+{
+    uint16_t value[3];
+    uint8_t found = 0;
+    uint8_t buf[3];
+    uint32_t rec;
+    uint8_t i;
+
+    for (i=0; i<7; i++) {
+        uint16_t v = (p->data[2+2*i]<<8) | p->data[3+2*i];
+        uint8_t id = (v >> 11) & 0x0F;
+        if (id >= 8 && id <= 10) {
+            value[id-8] = v & 0x7FF;
+            found |= 1U<<(id-8);
+        }
+    }
+    if (found != 7) {
+        return false;
+    }
+    rec = ((uint32_t)value[0]<<21) | ((uint32_t)value[1]<<10) | (value[2] & 0x3FF);
+    *type = (rec >> 16) & 0xFF;
+    *data = rec & 0xFFFF;
+    buf[0] = *type;
+    buf[1] = *data >> 8;
+    buf[2] = *data & 0xFF;
+    return (uint8_t)~crc_crc8(buf, 3) == (rec >> 24);
+}
+
+/*
+  run for a number of packets, printing the uplink records sent and
+  counting channel 8 extra data sends
+ */
+static void uplink_run(const char *name, uint8_t npackets)
+{
+    char line[200];
+    uint16_t len = 0;
+    uint8_t i, records = 0, extra = 0;
+
+    for (i=0; i<npackets; i++) {
+        const struct host_packet *p;
+        uint8_t type, j;
+        uint16_t data;
+
+        host_num_packets = 0;
+        if (!run_to_next_packet()) {
+            check(false, "uplink packet sent");
+            return;
+        }
+        p = &host_packets[0];
+        for (j=0; j<7; j++) {
+            if (((p->data[2+2*j] >> 3) & 0x0F) == 7) {
+                extra++;
+            }
+        }
+        if (decode_record(p, &type, &data)) {
+            records++;
+            if (len < sizeof(line)-12) {
+                len += sprintf(&line[len], " %02x:%04x", type, data);
+            }
+        }
+    }
+    line[len] = 0;
+    golden("UPLINK %s records=%u extra=%u%s", name, records, extra, line);
+}
+
+/*
+  build a telemetry packet as sent by the receiver
+ */
+static void make_telem(uint8_t pkt[16], enum telem_type type, const uint8_t *payload, uint8_t len)
+{
+    memset(pkt, 0, 16);
+    pkt[1] = type;
+    memcpy(&pkt[2], payload, len);
+    pkt[0] = crc_crc8(&pkt[1], 15);
+}
+
+/*
+  deliver a telemetry packet through the radio IRQ and process it
+ */
+static bool deliver_telem(const uint8_t pkt[16])
+{
+    uint8_t i;
+    host_queue_telem(pkt);
+    for (i=0; i<10 && host_telem_pending(); i++) {
+        run_to_next_packet();
+    }
+    cypress_process_telem();
+    return !host_telem_pending();
+}
+
+static void make_fw(uint8_t pkt[16], enum telem_type type, uint8_t seq, uint16_t offset, const uint8_t *data)
+{
+    uint8_t payload[12];
+    payload[0] = seq;
+    payload[1] = 8;
+    // little endian on the wire
+    payload[2] = offset & 0xFF;
+    payload[3] = offset >> 8;
+    memcpy(&payload[4], data, 8);
+    make_telem(pkt, type, payload, sizeof(payload));
+}
+
+static void test_telem(void)
+{
+    static const uint8_t status[7] = { 48, 22, TELEM_FLAG_ARM_OK, 7, 6, 6, 2 };
+    uint8_t pkt[16];
+    uint8_t data[128];
+    uint16_t i;
+    uint32_t crc;
+
+    setup();
+    cypress_start_send(true);
+
+    make_telem(pkt, TELEM_STATUS, status, sizeof(status));
+    check(deliver_telem(pkt), "status delivered");
+    check(memcmp(&t_status, status, sizeof(status)) == 0, "status decoded");
+    check(get_tx_power() <= 5, "tx_max applied");
+
+    // a corrupt packet is dropped
+    t_status.flight_mode = 0;
+    pkt[5] ^= 1;
+    deliver_telem(pkt);
+    check(t_status.flight_mode == 0, "bad crc dropped");
+
+    // one flash block, sent in order
+    for (i=0; i<sizeof(data); i++) {
+        data[i] = i * 13 + 5;
+    }
+    for (i=0; i<sizeof(data); i+=8) {
+        make_fw(pkt, TELEM_FW, i/8 + 1, 0x180 + i, &data[i]);
+        check(deliver_telem(pkt), "fw delivered");
+        check(telem_ack_value == i/8 + 1, "fw acked");
+    }
+    check(memcmp(&host_fw_slot[0x180], data, sizeof(data)) == 0, "fw block written");
+    check(host_fw_slot[0x17F] == 0xFF && host_fw_slot[0x200] == 0xFF, "fw block bounds");
+    crc = crc_crc32(host_fw_slot, sizeof(host_fw_slot));
+
+    // tune data goes to the buzzer
+    make_fw(pkt, TELEM_PLAY, 40, 8, data);
+    check(deliver_telem(pkt), "tune delivered");
+    check(host_tune_bytes == 8 && memcmp(&host_tune[8], data, 8) == 0, "tune added");
+    check(telem_ack_value == 40, "tune acked");
+
+    golden("TELEM status=%u/%u/%u fw_crc=%08lx overflow=%u",
+           t_status.pps, t_status.flight_mode, t_status.tx_max,
+           (unsigned long)crc, get_telem_overflow());
+}
+
+/*
+  the uplink record priorities, with a new ack and during a windowed
+  firmware transfer
+ */
+static void test_uplink(void)
+{
+    static const uint8_t status[7] = { 48, 22, TELEM_FLAG_UPLINK, 7, 6, 6, 2 };
+    uint8_t pkt[16];
+    uint8_t data[8];
+    uint8_t block;
+    uint16_t bitmap;
+
+    setup();
+    cypress_start_send(true);
+    t_status.flags = 0;
+    uplink_run("legacy", 16);
+
+    // the receiver shows it decodes records
+    make_telem(pkt, TELEM_STATUS, status, sizeof(status));
+    check(deliver_telem(pkt), "uplink status delivered");
+    uplink_run("idle", 48);
+
+    telem_ack_value = 42;
+    uplink_run("ack", 16);
+
+    memset(data, 0x5A, sizeof(data));
+    make_fw(pkt, TELEM_FW_WINDOW, 43, 0x108, data);
+    check(deliver_telem(pkt), "window chunk delivered");
+    uplink_run("window", 16);
+
+    // a late chunk for another block leaves the block in progress alone
+    make_fw(pkt, TELEM_FW_WINDOW, 44, 0x80, data);
+    check(deliver_telem(pkt), "stray chunk delivered");
+    check(get_fw_window_bitmap(&block, &bitmap) && block == 2 && bitmap == 0x0002,
+          "stray chunk dropped");
+    check(host_fw_slot[0x108] != 0x5A && host_fw_slot[0x80] != 0x5A, "stray chunk not flushed");
+}
+
+/*
+  channel values for a few stick positions
+ */
+static void test_channels(void)
+{
+    static const uint16_t sticks[][4] = {
+        { 512, 512, 512, 100 },
+        { 0, 0, 0, 0 },
+        { 1023, 1023, 1023, 1023 },
+        { 300, 700, 450, 900 },
+    };
+    uint8_t i, c;
+
+    setup();
+    for (i=0; i<sizeof(sticks)/sizeof(sticks[0]); i++) {
+        char line[128];
+        int len = 0;
+        memcpy(host_adc, sticks[i], sizeof(host_adc));
+        channels_sample();
+        for (c=0; c<7; c++) {
+            len += snprintf(&line[len], sizeof(line)-len, " %u", channel_value(c));
+        }
+        golden("CHAN %u:%s", i, line);
+    }
+
+    // buttons change state after 4 ticks, and all bits change together
+    host_gpio_idr[PIN_RIGHT_BUTTON>>8] &= ~(PIN_RIGHT_BUTTON & 0xFF);
+    host_gpio_idr[PIN_USER>>8] |= PIN_USER & 0xFF;
+    for (i=0; i<3; i++) {
+        buttons_tick();
+    }
+    check(get_buttons() == 0, "buttons debounced");
+    buttons_tick();
+    check(get_buttons() == (BUTTON_RIGHT|BUTTON_POWER), "buttons pressed");
+    channels_sample();
+    golden("BUTTONS 0x%x ch4=%u ch5=%u ch6=%u", get_buttons(),
+           channel_value(4), channel_value(5), channel_value(6));
+}
+
+static void test_rtttl(void)
+{
+    static const char *const tunes[] = {
+        "Startup:d=8,o=6,b=480:a,4p,a,4p,a,4p,c,4p",
+        "Error:d=4,o=6,b=400:8a,8a,8a,p,a,a,a,p",
+        "notify:d=4,o=6,b=320:16g,16g,16c#7",
+        "tune:d=16,o=5,b=125:8g.,a#,2c6,p,32d#6,4f#4,b7",
+    };
+    struct rtttl_note notes[32];
+    uint8_t i, j;
+
+    for (i=0; i<sizeof(tunes)/sizeof(tunes[0]); i++) {
+        uint8_t buf[3*32];
+        uint8_t n = rtttl_parse(tunes[i], notes, 32);
+        for (j=0; j<n; j++) {
+            buf[j*3] = notes[j].note;
+            buf[j*3+1] = notes[j].duration_ms >> 8;
+            buf[j*3+2] = notes[j].duration_ms & 0xFF;
+        }
+        golden("RTTTL %u n=%u crc=%08lx first=%u/%u", i, n,
+               (unsigned long)crc_crc32(buf, n*3), notes[0].note, notes[0].duration_ms);
+    }
+}
+
+static bool journal_clear(void)
+{
+    uint16_t i;
+    for (i=0; i<EEPROM_JOURNAL_SIZE; i++) {
+        if (host_eeprom[EEPROM_JOURNAL_OFFSET+i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+  lazy saves, journal wrap and a save cut short by power loss
+ */
+static void test_settings(void)
+{
+    uint16_t i;
+
+    setup();
+    check(settings_get(EEPROM_WIFICHAN_OFFSET) == 6, "settings from fixed cells");
+
+    settings_set(EEPROM_TXMAX, 7);
+    settings_update();
+    check(journal_clear(), "save deferred");
+    host_run_us(SETTINGS_FLUSH_MS*1000UL);
+    for (i=0; i<8; i++) {
+        settings_update();
+    }
+    check(!journal_clear(), "save written");
+    settings_init();
+    check(settings_get(EEPROM_TXMAX) == 7 && settings_get(EEPROM_WIFICHAN_OFFSET) == 6,
+          "settings reloaded");
+
+    for (i=0; i<300; i++) {
+        settings_set(EEPROM_NOTE_ADJUST, i & 0xFF);
+        settings_flush();
+    }
+    settings_init();
+    check(settings_get(EEPROM_NOTE_ADJUST) == (299 & 0xFF), "journal wrapped");
+
+    // all but the check byte of a save
+    settings_set(EEPROM_NOTE_ADJUST, 5);
+    host_run_us(SETTINGS_FLUSH_MS*1000UL);
+    for (i=0; i<SETTINGS_NUM+1; i++) {
+        settings_update();
+    }
+    settings_init();
+    check(settings_get(EEPROM_NOTE_ADJUST) == (299 & 0xFF), "torn save ignored");
+
+    golden("SETTINGS eeprom_crc=%08lx", (unsigned long)crc_crc32(host_eeprom, sizeof(host_eeprom)));
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+  average traffic per packet over a second of sending, and host time
+  per packet. Not part of the golden output
+ */
+static void bench_send(void)
+{
+    uint32_t packets = 0;
+    double t0, t;
+
+    setup();
+    cypress_start_send(true);
+    host_reset_counts();
+    t0 = now_ns();
+    while (packets < 1000) {
+        host_num_packets = 0;
+        host_run_us(10000);
+        packets += host_num_packets;
+    }
+    t = now_ns() - t0;
+    printf("BENCH packets=%u spi/pkt=%.1f bytes/pkt=%.1f rd/pkt=%.1f wr/pkt=%.1f q/pkt=%.1f host_ns/pkt=%.0f\n",
+           packets,
+           host_counts.spi_transactions / (double)packets,
+           host_counts.spi_bytes / (double)packets,
+           host_counts.reg_reads / (double)packets,
+           host_counts.reg_writes / (double)packets,
+           host_counts.queued_writes / (double)packets,
+           t / packets);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = NULL;
+    int i;
+
+    for (i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-u") == 0) {
+            update = true;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            host_verbose = true;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL) {
+        printf("usage: hosttest [-u] [-v] golden.txt\n");
+        return 1;
+    }
+    golden_file = fopen(path, update ? "w" : "r");
+    if (golden_file == NULL) {
+        perror(path);
+        return 1;
+    }
+
+    test_packets();
+    test_chanplan();
+    test_dsmx();
+    test_telem();
+    test_uplink();
+    test_channels();
+    test_rtttl();
+    test_settings();
+    if (!update) {
+        char extra[256];
+        if (fgets(extra, sizeof(extra), golden_file) != NULL) {
+            printf("golden file has lines past %u\n", golden_lines);
+            failures++;
+        }
+    }
+    fclose(golden_file);
+
+    bench_send();
+
+    if (update) {
+        printf("wrote %u golden lines to %s, %u failures\n", golden_lines, path, failures);
+    } else {
+        printf("%u golden lines, %u failures\n", golden_lines, failures);
+    }
+    return failures == 0 ? 0 : 1;
+}
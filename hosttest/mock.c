@@ -0,0 +1,551 @@
+/*
+  host mocks of the STM8 drivers used by the lib/ hot paths
+
+  cypress.c and channels.c only reach the hardware through the SPI,
+  GPIO, ADC, timer, EEPROM and flash drivers, so the register map is
+  modelled behind those APIs: a CYRF6936 register file behind the SPI
+  functions and the port registers behind the GPIO functions. This
+  file is built without util.h, as its printf() clashes with the host
+  stdio.h
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <spi.h>
+#include <gpio.h>
+#include <config.h>
+#include <timer.h>
+#include <adc.h>
+#include <flash.h>
+#include <eeprom.h>
+#include <buzzer.h>
+#include <cypress.h>
+#include "mock.h"
+
+struct host_counts host_counts;
+struct host_packet host_packets[HOST_MAX_PACKETS];
+uint8_t host_num_packets;
+
+uint32_t host_time_us;
+uint8_t host_eeprom[1024];
+uint8_t host_fw_slot[16*1024];
+uint16_t host_adc[4];
+uint8_t host_gpio_idr[9];
+uint8_t host_gpio_odr[9];
+uint8_t host_rssi[0x60];
+bool host_verbose;
+
+uint8_t host_tune[64];
+uint16_t host_tune_bytes;
+
+// time for one SPI byte at the 1MHz clock set by spi_init()
+#define SPI_BYTE_US 8
+
+// a 16 byte packet at 8DR takes about 1ms on air
+#define TX_AIR_US 1100
+
+// delay from starting receive to a telemetry packet being complete
+#define RX_DELAY_US 1500
+
+// CYRF6936 registers and bits the model acts on
+#define REG_CHANNEL       0x00
+#define REG_TX_CTRL       0x02
+#define REG_TX_IRQ_STATUS 0x04
+#define REG_RX_CTRL       0x05
+#define REG_RX_IRQ_STATUS 0x07
+#define REG_RX_COUNT      0x09
+#define REG_XACT_CFG      0x0F
+#define REG_RSSI          0x13
+#define REG_CRC_SEED_LSB  0x15
+#define REG_CRC_SEED_MSB  0x16
+#define REG_TX_BUFFER     0x20
+#define REG_RX_BUFFER     0x21
+#define REG_SOP_CODE      0x22
+#define REG_DATA_CODE     0x23
+#define REG_MFG_ID        0x25
+#define FLAG_WRITE        0x80
+#define FLAG_AUTO_INC     0x40
+#define TX_GO             0x80
+#define TXC_IRQEN         0x02
+#define TXC_IRQ           0x02
+#define RX_GO             0x80
+#define RXC_IRQEN         0x02
+#define RXC_IRQ           0x02
+#define FRC_END           0x20
+
+static const uint8_t mfg_id[6] = { 0x3A, 0xC5, 0x17, 0x9E, 0x01, 0x00 };
+
+static struct {
+    uint8_t regs[0x40];
+    uint8_t tx_file[16];
+    uint8_t rx_file[16];
+    uint8_t sop_file[8];
+    uint8_t data_file[16];
+
+    // SPI framing
+    bool forced_cs;
+    bool have_addr;
+    uint8_t addr;
+    uint8_t index;
+
+    // pending air events
+    bool tx_busy;
+    uint32_t tx_done_us;
+    bool rx_busy;
+    uint32_t rx_done_us;
+    bool telem_queued;
+    uint8_t telem[16];
+} radio;
+
+static struct {
+    uint32_t deadline_us;
+    timer_callback_t callback;
+} slots[TIMER_NUM_SLOTS];
+
+// deadline of the timer callback running
+static uint32_t callback_deadline_us;
+
+void host_reset(void)
+{
+    memset(&radio, 0, sizeof(radio));
+    memset(slots, 0, sizeof(slots));
+    memset(host_packets, 0, sizeof(host_packets));
+    host_num_packets = 0;
+    host_time_us = 0;
+    memset(host_gpio_odr, 0, sizeof(host_gpio_odr));
+    // buttons released: pulled up, except the active high power button
+    memset(host_gpio_idr, 0xFF, sizeof(host_gpio_idr));
+    host_gpio_idr[PIN_USER>>8] &= ~(PIN_USER & 0xFF);
+    host_tune_bytes = 0;
+    host_reset_counts();
+}
+
+void host_reset_counts(void)
+{
+    memset(&host_counts, 0, sizeof(host_counts));
+}
+
+/*
+  queue a telemetry packet, received in the next receive window
+ */
+void host_queue_telem(const uint8_t pkt[16])
+{
+    memcpy(radio.telem, pkt, 16);
+    radio.telem_queued = true;
+}
+
+bool host_telem_pending(void)
+{
+    return radio.telem_queued;
+}
+
+static bool is_file(uint8_t reg)
+{
+    return (reg >= REG_TX_BUFFER && reg <= REG_DATA_CODE) || reg == REG_MFG_ID;
+}
+
+static void radio_write(uint8_t reg, uint8_t idx, uint8_t v)
+{
+    host_counts.reg_writes++;
+    switch (reg) {
+    case REG_TX_BUFFER:
+        if (idx < 16) {
+            radio.tx_file[idx] = v;
+        }
+        break;
+    case REG_SOP_CODE:
+        if (idx < 8) {
+            radio.sop_file[idx] = v;
+        }
+        break;
+    case REG_DATA_CODE:
+        if (idx < 16) {
+            radio.data_file[idx] = v;
+        }
+        break;
+    case REG_XACT_CFG:
+        // forcing the end state completes at once and ends a receive
+        radio.regs[reg] = v & ~FRC_END;
+        if (v & FRC_END) {
+            radio.rx_busy = false;
+        }
+        break;
+    case REG_TX_CTRL:
+        radio.regs[reg] = v & ~TX_GO;
+        if (v & TX_GO) {
+            if (host_num_packets < HOST_MAX_PACKETS) {
+                struct host_packet *p = &host_packets[host_num_packets++];
+                p->channel = radio.regs[REG_CHANNEL];
+                p->crc_seed = radio.regs[REG_CRC_SEED_LSB] | (radio.regs[REG_CRC_SEED_MSB]<<8);
+                memcpy(p->sop_code, radio.sop_file, 8);
+                memcpy(p->data, radio.tx_file, 16);
+                p->go_us = host_time_us - callback_deadline_us;
+            }
+            radio.tx_busy = true;
+            radio.tx_done_us = host_time_us + TX_AIR_US;
+        }
+        break;
+    case REG_MFG_ID:
+        // 0xFF powers up the id fuses for reading
+        radio.regs[reg] = v;
+        break;
+    case REG_RX_CTRL:
+        radio.regs[reg] = v & ~RX_GO;
+        if ((v & RX_GO) && radio.telem_queued) {
+            radio.rx_busy = true;
+            radio.rx_done_us = host_time_us + RX_DELAY_US;
+        }
+        break;
+    default:
+        if (!is_file(reg)) {
+            radio.regs[reg] = v;
+        }
+        break;
+    }
+}
+
+static uint8_t radio_read(uint8_t reg, uint8_t idx)
+{
+    uint8_t v;
+    host_counts.reg_reads++;
+    switch (reg) {
+    case REG_TX_IRQ_STATUS:
+    case REG_RX_IRQ_STATUS:
+        // IRQ status is cleared by reading
+        v = radio.regs[reg];
+        radio.regs[reg] = 0;
+        return v;
+    case REG_RSSI:
+        return host_rssi[radio.regs[REG_CHANNEL] % sizeof(host_rssi)] & 0x1F;
+    case REG_TX_BUFFER:
+        return idx < 16 ? radio.tx_file[idx] : 0;
+    case REG_RX_BUFFER:
+        return idx < 16 ? radio.rx_file[idx] : 0;
+    case REG_SOP_CODE:
+        return idx < 8 ? radio.sop_file[idx] : 0;
+    case REG_DATA_CODE:
+        return idx < 16 ? radio.data_file[idx] : 0;
+    case REG_MFG_ID:
+        return (radio.regs[REG_MFG_ID] == 0xFF && idx < 6) ? mfg_id[idx] : 0;
+    default:
+        return radio.regs[reg];
+    }
+}
+
+static void cs_begin(void)
+{
+    host_counts.spi_transactions++;
+    radio.have_addr = false;
+}
+
+/*
+  one SPI byte. The first byte of a transaction is the address, then
+  file registers advance their own index and others only advance with
+  FLAG_AUTO_INC
+ */
+static uint8_t spi_byte(uint8_t out)
+{
+    uint8_t reg, ret = 0;
+
+    host_counts.spi_bytes++;
+    host_time_us += SPI_BYTE_US;
+    if (!radio.have_addr) {
+        radio.have_addr = true;
+        radio.addr = out;
+        radio.index = 0;
+        return 0;
+    }
+    reg = radio.addr & 0x3F;
+    if (radio.addr & FLAG_WRITE) {
+        radio_write(reg, radio.index, out);
+    } else {
+        ret = radio_read(reg, radio.index);
+    }
+    if (is_file(reg)) {
+        radio.index++;
+    } else if (radio.addr & FLAG_AUTO_INC) {
+        radio.addr = (radio.addr & ~0x3F) | ((reg+1) & 0x3F);
+    }
+    return ret;
+}
+
+void spi_force_chip_select(bool set)
+{
+    if (set && !radio.forced_cs) {
+        radio.forced_cs = true;
+        cs_begin();
+    } else if (!set) {
+        radio.forced_cs = false;
+    }
+}
+
+void spi_transfer(uint8_t n, const uint8_t *sendbuf, uint8_t *recvbuf)
+{
+    if (!radio.forced_cs) {
+        cs_begin();
+    }
+    while (n--) {
+        uint8_t v = spi_byte(sendbuf ? *sendbuf++ : 0);
+        if (recvbuf) {
+            *recvbuf++ = v;
+        }
+    }
+}
+
+void spi_write(uint8_t n, const uint8_t *buf)
+{
+    spi_transfer(n, buf, NULL);
+}
+
+uint8_t spi_read1(void)
+{
+    uint8_t v = 0;
+    spi_transfer(1, NULL, &v);
+    return v;
+}
+
+void spi_read_registers(uint8_t reg, uint8_t *buf, uint8_t len)
+{
+    bool old_force = radio.forced_cs;
+    spi_force_chip_select(true);
+    spi_write(1, &reg);
+    spi_transfer(len, NULL, buf);
+    spi_force_chip_select(old_force);
+}
+
+/*
+  queued writes are sent at once
+ */
+void spi_queue_start(const struct spi_write *writes, uint8_t count, spi_callback_t callback)
+{
+    while (count--) {
+        host_counts.queued_writes++;
+        cs_begin();
+        spi_byte(writes->reg);
+        if (writes->data) {
+            uint8_t i;
+            for (i=0; i<writes->len; i++) {
+                spi_byte(writes->data[i]);
+            }
+        } else {
+            spi_byte(writes->value);
+        }
+        writes++;
+    }
+    if (callback) {
+        callback();
+    }
+}
+
+void spi_queue_wait(void)
+{
+}
+
+bool spi_queue_busy(void)
+{
+    return false;
+}
+
+void gpio_config(uint16_t pins, enum gpio_config config)
+{
+    host_counts.gpio_accesses++;
+    if (config & GPIO_SET) {
+        gpio_set(pins);
+    } else if (config & GPIO_CLEAR) {
+        gpio_clear(pins);
+    }
+}
+
+void gpio_set(uint16_t pins)
+{
+    host_counts.gpio_accesses++;
+    host_gpio_odr[pins>>8] |= pins & 0xFF;
+}
+
+void gpio_clear(uint16_t pins)
+{
+    host_counts.gpio_accesses++;
+    host_gpio_odr[pins>>8] &= ~(pins & 0xFF);
+}
+
+bool gpio_get(uint16_t pin)
+{
+    host_counts.gpio_accesses++;
+    return (host_gpio_idr[pin>>8] & pin & 0xFF) != 0;
+}
+
+uint8_t gpio_read_port(uint8_t port)
+{
+    host_counts.gpio_accesses++;
+    return host_gpio_idr[port];
+}
+
+uint16_t adc_value(uint8_t chan)
+{
+    host_counts.adc_reads++;
+    return host_adc[chan];
+}
+
+void adc_get_snapshot(struct adc_snapshot *snap)
+{
+    static uint8_t seq;
+    host_counts.adc_reads++;
+    memcpy(snap->value, host_adc, sizeof(snap->value));
+    snap->seq = ++seq;
+}
+
+uint32_t micros(void)
+{
+    return host_time_us;
+}
+
+uint32_t timer_get_ms(void)
+{
+    return host_time_us / 1000;
+}
+
+void delay_us(uint16_t d)
+{
+    host_time_us += d;
+}
+
+void delay_ms(uint16_t d)
+{
+    host_time_us += d * 1000UL;
+}
+
+void timer_call_after_us(uint8_t slot, uint32_t dt_us, timer_callback_t callback)
+{
+    host_counts.timer_calls++;
+    slots[slot].deadline_us = host_time_us + dt_us;
+    slots[slot].callback = callback;
+}
+
+void timer_call_next_us(uint8_t slot, uint32_t dt_us, timer_callback_t callback)
+{
+    uint32_t deadline_us = slots[slot].deadline_us + dt_us;
+    host_counts.timer_calls++;
+    if ((int32_t)(host_time_us - deadline_us) > (int32_t)dt_us) {
+        deadline_us = host_time_us + dt_us;
+    }
+    slots[slot].deadline_us = deadline_us;
+    slots[slot].callback = callback;
+}
+
+void timer_cancel(uint8_t slot)
+{
+    host_counts.timer_calls++;
+    slots[slot].callback = NULL;
+}
+
+uint8_t eeprom_read(uint16_t offset)
+{
+    return host_eeprom[offset % sizeof(host_eeprom)];
+}
+
+void eeprom_write(uint16_t offset, uint8_t value)
+{
+    host_eeprom[offset % sizeof(host_eeprom)] = value;
+}
+
+/*
+  the slot address is truncated to 16 bits by the flash API, so
+  recover the offset into host_fw_slot
+ */
+void flash_write_block(uint16_t addr, const uint8_t *data)
+{
+    uint16_t offset = addr - (uint16_t)(uintptr_t)host_fw_slot;
+    if (offset <= sizeof(host_fw_slot) - FLASH_BLOCK_SIZE) {
+        memcpy(&host_fw_slot[offset], data, FLASH_BLOCK_SIZE);
+    }
+}
+
+void buzzer_tune_add(uint16_t offset, const uint8_t *data, uint8_t length)
+{
+    if (offset + length <= sizeof(host_tune)) {
+        memcpy(&host_tune[offset], data, length);
+    }
+    host_tune_bytes += length;
+}
+
+uint8_t get_bl_version(void)
+{
+    return 3;
+}
+
+void host_printf(const char *fmt, ...)
+{
+    host_counts.printfs++;
+    if (host_verbose) {
+        va_list ap;
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+    }
+}
+
+/*
+  run the timer slots and radio interrupts for dt_us of host time
+ */
+void host_run_us(uint32_t dt_us)
+{
+    uint32_t end_us = host_time_us + dt_us;
+
+    while (true) {
+        uint32_t next_us = end_us;
+        int8_t slot = -1;
+        uint8_t i;
+        bool irq = false;
+
+        for (i=0; i<TIMER_NUM_SLOTS; i++) {
+            if (slots[i].callback && (int32_t)(slots[i].deadline_us - next_us) < 0) {
+                next_us = slots[i].deadline_us;
+                slot = i;
+            }
+        }
+        if (radio.tx_busy && (int32_t)(radio.tx_done_us - next_us) < 0) {
+            next_us = radio.tx_done_us;
+            slot = -1;
+            irq = true;
+        }
+        if (radio.rx_busy && (int32_t)(radio.rx_done_us - next_us) < 0) {
+            next_us = radio.rx_done_us;
+            slot = -1;
+            irq = true;
+        }
+        if (slot < 0 && !irq) {
+            break;
+        }
+        if ((int32_t)(next_us - host_time_us) > 0) {
+            host_time_us = next_us;
+        }
+        if (slot >= 0) {
+            timer_callback_t callback = slots[slot].callback;
+            slots[slot].callback = NULL;
+            callback_deadline_us = slots[slot].deadline_us;
+            callback();
+            continue;
+        }
+        if (radio.tx_busy && radio.tx_done_us == next_us) {
+            radio.tx_busy = false;
+            radio.regs[REG_TX_IRQ_STATUS] |= TXC_IRQ;
+            if (radio.regs[REG_TX_CTRL] & TXC_IRQEN) {
+                cypress_irq();
+            }
+        } else {
+            radio.rx_busy = false;
+            radio.telem_queued = false;
+            memcpy(radio.rx_file, radio.telem, 16);
+            radio.regs[REG_RX_COUNT] = 16;
+            radio.regs[REG_RX_IRQ_STATUS] |= RXC_IRQ;
+            if (radio.regs[REG_RX_CTRL] & RXC_IRQEN) {
+                cypress_irq();
+            }
+        }
+    }
+    if ((int32_t)(end_us - host_time_us) > 0) {
+        host_time_us = end_us;
+    }
+}
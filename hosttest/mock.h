@@ -0,0 +1,55 @@
+/*
+  host mocks of the STM8 drivers used by cypress.c and channels.c. The
+  SPI functions drive a model of the CYRF6936 register map and the
+  GPIO functions a model of the port registers
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+  operation counts, reset with host_reset_counts()
+ */
+struct host_counts {
+    uint32_t spi_transactions; // chip select cycles
+    uint32_t spi_bytes;
+    uint32_t reg_reads;        // radio register bytes read
+    uint32_t reg_writes;       // radio register bytes written
+    uint32_t queued_writes;    // writes sent by spi_queue_start()
+    uint32_t gpio_accesses;
+    uint32_t adc_reads;
+    uint32_t timer_calls;      // slot schedules and cancels
+    uint32_t printfs;
+};
+extern struct host_counts host_counts;
+
+// a packet sent by the radio
+struct host_packet {
+    uint8_t channel;
+    uint16_t crc_seed;
+    uint8_t sop_code[8];
+    uint8_t data[16];
+    uint32_t go_us; // host time from the timer deadline to TX_GO
+};
+#define HOST_MAX_PACKETS 64
+
+extern struct host_packet host_packets[HOST_MAX_PACKETS];
+extern uint8_t host_num_packets;
+
+extern uint32_t host_time_us;
+extern uint8_t host_eeprom[1024];
+extern uint8_t host_fw_slot[16*1024];
+extern uint16_t host_adc[4];
+extern uint8_t host_gpio_idr[9];
+extern uint8_t host_gpio_odr[9];
+extern uint8_t host_rssi[0x60];
+extern bool host_verbose;
+
+// tune data passed to buzzer_tune_add()
+extern uint8_t host_tune[64];
+extern uint16_t host_tune_bytes;
+
+void host_reset(void);
+void host_reset_counts(void);
+void host_queue_telem(const uint8_t pkt[16]);
+bool host_telem_pending(void);
+void host_run_us(uint32_t dt_us);
@@ -1,7 +1,19 @@
 // ADC functions
+#define ADC_NUM_CHANS 4
+
+/*
+  one set of stick values, all sampled in the same scans
+ */
+struct adc_snapshot {
+    uint16_t value[ADC_NUM_CHANS];
+    uint8_t seq;
+};
+
 void adc_init(void);
 uint16_t adc_value(uint8_t chan);
+void adc_get_snapshot(struct adc_snapshot *snap);
 void adc_irq(void);
+void adc_start(void);
 
 // mode2 stick mapping
 #define STICK_ROLL     1
@@ -0,0 +1,42 @@
+/*
+  layout of a firmware image in the new firmware slot, as created by
+  blimage:
+
+    uint16_t size
+    uint32_t crc            crc_crc32() of the firmware
+    uint8_t  firmware[size]
+
+  all values are big-endian. The bootloader only reprograms the
+  FW_BLOCK_SIZE blocks that differ from the running firmware.
+
+  A compressed image (blimage -z) instead has:
+
+    uint16_t magic          FW_COMPRESSED_MAGIC
+    uint32_t zcrc           crc_crc32() of the compressed data
+    uint16_t zsize          size of the compressed data
+    uint16_t size           size of the firmware
+    uint32_t crc            crc_crc32() of the firmware
+    uint8_t  zdata[zsize]
+
+  The magic is not a valid size, so older bootloaders reject these.
+  The compressed data is a sequence of tokens:
+
+    0LLLLLLL                 L+1 literal bytes follow
+    1LLLLDDD DDDDDDDD        copy L+3 bytes from D+1 bytes back
+
+  The window is the output itself, so the bootloader reads matches
+  back out of the flash it has already written and only needs a one
+  block RAM buffer
+ */
+
+#pragma once
+
+#define FW_HEADER_LEN 6
+#define FW_BLOCK_SIZE 128
+
+#define FW_COMPRESSED_MAGIC 0xFFFF
+#define FW_COMPRESSED_HEADER_LEN 14
+#define FW_LZ_MAX_LITERALS 128
+#define FW_LZ_MIN_MATCH 3
+#define FW_LZ_MAX_MATCH (FW_LZ_MIN_MATCH+15)
+#define FW_LZ_WINDOW 2048
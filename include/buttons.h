@@ -0,0 +1,17 @@
+#include <stdint.h>
+
+/*
+  button input layer. The button ports are read once per 1ms tick and
+  all buttons are debounced together, giving one consistent word of
+  BUTTON_* bits, set while pressed
+ */
+#define BUTTON_LEFT 0x01
+#define BUTTON_RIGHT 0x02
+#define BUTTON_LEFT_SHOULDER 0x04
+#define BUTTON_RIGHT_SHOULDER 0x08
+#define BUTTON_POWER 0x10
+
+void buttons_tick(void);
+
+// get buttons
+uint8_t get_buttons(void);
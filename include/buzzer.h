@@ -10,6 +10,7 @@ void buzzer_init(void);
 
 void buzzer_tone(enum beep_tone tone, uint16_t width_ms, uint8_t repeats);
 void buzzer_tune(uint8_t t);
+void buzzer_tune_blocking(uint8_t t);
 void buzzer_tune_add(uint16_t offset, const uint8_t *data, uint8_t length);
 void buzzer_play_pending(void);
 
@@ -2,17 +2,39 @@
   handle channel output values
  */
 
+/*
+  each stick channel is mapped through a piecewise linear curve of
+  CURVE_POINTS 11 bit outputs, for stick inputs 0, CURVE_STEP,
+  2*CURVE_STEP ... 1024. The curves are stored in EEPROM at
+  EEPROM_CURVE_OFFSET as CURVE_MAGIC followed by CURVE_NUM_AXES
+  tables of big-endian uint16_t points, in channel order
+ */
+#define CURVE_NUM_AXES 4
+#define CURVE_POINTS 33
+#define CURVE_SHIFT 5
+#define CURVE_STEP (1U<<CURVE_SHIFT)
+#define CURVE_MAGIC 0xC5
+#define CURVE_EEPROM_SIZE (1 + CURVE_NUM_AXES*CURVE_POINTS*2)
 
 /*
-  return an 11 bit channel output value
+  the original linear stick scaling of a 0 to 1000 stick value, in
+  integer maths with truncating division. This is shared by the
+  firmware and mkcurves so a flashed "0 100" curve matches the built-in
+  default exactly
  */
-uint16_t channel_value(uint8_t chan);
+#define CURVE_LINEAR(v) (((((int16_t)(v) - 500) * 27 / 32) + 512) * 2)
 
-#define BUTTON_LEFT 0x01
-#define BUTTON_RIGHT 0x02
-#define BUTTON_LEFT_SHOULDER 0x04
-#define BUTTON_RIGHT_SHOULDER 0x08
-#define BUTTON_POWER 0x10
+/*
+  load the stick curves from EEPROM
+ */
+void channels_init(void);
 
-// get buttons
-uint8_t get_buttons(void);
+/*
+  latch the stick values used by channel_value()
+ */
+void channels_sample(void);
+
+/*
+  return an 11 bit channel output value
+ */
+uint16_t channel_value(uint8_t chan);
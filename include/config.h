@@ -53,13 +53,61 @@
 #define PIN_RIGHT_BUTTON PIN_SW4
 #define PIN_POWER_BUTTON PIN_USER
 
+// ADC oversampling, 2^N scans are averaged per stick snapshot
+#define ADC_OVERSAMPLE_SHIFT 2
+
+// adaptive TX power holds the averaged telemetry RSSI within
+// POWER_HYSTERESIS of the target. EEPROM_POWER_TARGET overrides it
+#define POWER_TARGET_RSSI 20
+#define POWER_HYSTERESIS 3
+
 // time to power off, ms
 #define POWER_OFF_MS 2000
 #define POWER_OFF_DISARMED_MS 500
 
 // location in flash of new firmware
+#ifndef NEW_FIRMWARE_BASE
 #define NEW_FIRMWARE_BASE 0xC000
+#endif
+
+// boot without fixed delays: the radio is polled out of reset, the
+// inputs get a short settle time and the DSM2 channel pair found by
+// the last scan is reused when it is still clean. Build with
+// -DFAST_BOOT=0 for the original timings and a scan on every boot
+#ifndef FAST_BOOT
+#define FAST_BOOT 1
+#endif
+
+// with FAST_BOOT, time for the sticks and buttons to settle at power
+// on. Covers a batch of ADC scans and the button debounce, ms
+#define FAST_BOOT_INPUT_MS 10
+
+// send prioritised, CRC checked uplink records in channels 8 to 10
+// to receivers that set TELEM_FLAG_UPLINK, see telem_structure.h.
+// Build with -DUPLINK_RECORDS=0 to leave them out
+#ifndef UPLINK_RECORDS
+#define UPLINK_RECORDS 1
+#endif
+
+// report the percentage of time the main loop sleeps in WFI on the
+// status line. Build with -DIDLE_STATS=1 to measure
+#ifndef IDLE_STATS
+#define IDLE_STATS 0
+#endif
 
-// should we support DSMX ?
+// time interrupt handlers and the packet send, reported on the status
+// line and in channel 8 extra data. Build with -DPERF_STATS=1 to use
+#ifndef PERF_STATS
+#define PERF_STATS 0
+#endif
+
+// with PERF_STATS, optionally mirror the phases in PERF_PIN_MASK (bits
+// of enum perf_id) on a spare pin for a logic analyser
+//#define PERF_PIN (GPIO_PORTx|GPIO_PINy)
+#define PERF_PIN_MASK 0xFF
+
+// should we support DSMX ? The host test harness builds with it on
+#ifndef SUPPORT_DSMX
 #define SUPPORT_DSMX 0
+#endif
 
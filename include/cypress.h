@@ -1,5 +1,6 @@
 void cypress_init(void);
 void cypress_irq();
+void write_multiple(uint8_t reg, uint8_t n, const uint8_t *data);
 void cypress_start_bind_send(bool use_dsm2);
 void cypress_start_send(bool use_dsm2);
 void cypress_start_FCC_test(void);
@@ -9,9 +10,27 @@ void cypress_set_CW_mode(bool cw);
 void cypress_change_FCC_channel(int8_t change);
 void cypress_FCC_toggle_scan(void);
 uint8_t get_tx_power(void);
+uint8_t get_link_loss(void);
+uint8_t get_link_rssi(void);
 int8_t get_FCC_chan(void);
 uint8_t get_FCC_power(void);
 void cypress_set_pps_rssi(void);
+void cypress_flush_firmware(void);
+void cypress_process_telem(void);
+uint16_t get_telem_overflow(void);
+uint16_t get_write_queue_overflow(void);
+bool get_fw_window_bitmap(uint8_t *block, uint16_t *bitmap);
+uint8_t get_fw_resume_block(void);
+uint8_t get_noise_floor(uint8_t hop);
+uint8_t get_next_noise_floor(void);
 uint8_t get_telem_rssi(void);
 uint8_t get_send_pps(void);
 uint8_t get_telem_pps(void);
+void cypress_set_frame_profile(uint8_t profile);
+uint8_t get_frame_profile(void);
+uint32_t get_first_send_ms(void);
+
+// frame rate profiles, stored in EEPROM_FRAME_PROFILE
+#define DSM_FRAME_8MS  0 // the original 2ms+6ms timing, the default
+#define DSM_FRAME_22MS 1 // low power
+#define DSM_FRAME_NUM_PROFILES 2
@@ -11,4 +11,23 @@ void eeprom_lock(void);
 #define EEPROM_WIFICHAN_OFFSET 1
 #define EEPROM_TXMAX 2
 #define EEPROM_NOTE_ADJUST 3
+#define EEPROM_POWER_TARGET 4
+#define EEPROM_FRAME_PROFILE 5
+
+// OTA update progress, 6 byte image header and 16 byte block bitmap
+#define EEPROM_OTA_PROGRESS_OFFSET 0x20
+
+// DSM2 channel pair of the last scan, see cypress.c
+#define EEPROM_CHAN_CACHE_OFFSET 0x40
+
+// header of the image last applied by the bootloader, see bootloader/main.c
+#define EEPROM_FW_APPLIED_OFFSET 0x48
+
+// stick curve tables, see channels.h
+#define EEPROM_CURVE_OFFSET 0x100
+
+// settings journal, see settings.c. Offsets 0 to 5 hold the settings
+// of firmware from before the journal
+#define EEPROM_JOURNAL_OFFSET 0x240
+#define EEPROM_JOURNAL_SIZE 0x1C0
 
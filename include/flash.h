@@ -0,0 +1,12 @@
+/*
+  flash block programming
+ */
+#include <stdint.h>
+
+#define FLASH_BLOCK_SIZE 128
+
+/*
+  program one FLASH_BLOCK_SIZE block at a block aligned address from
+  a RAM buffer
+ */
+void flash_write_block(uint16_t addr, const uint8_t *data);
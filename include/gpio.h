@@ -39,3 +39,4 @@ void gpio_set(uint16_t pins);
 void gpio_clear(uint16_t pins);
 void gpio_toggle(uint16_t pins);
 bool gpio_get(uint16_t pin);
+uint8_t gpio_read_port(uint8_t port);
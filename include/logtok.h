@@ -0,0 +1,37 @@
+/*
+  tokenized logging. This header is common to the transmitter and the
+  mklogtok and logdecode host tools
+
+  With LOG_TOKENS=1 the build runs mklogtok over the sources, which
+  gives each printf format string a message id, writes the strings to
+  logtok.dict and replaces each call
+    printf("fmt", args...)
+  with
+    log_token(id, spec, args...)
+  The low 12 bits of the id index logtok.dict and the top 4 bits are
+  the number of arguments. spec has 2 bits per argument, first
+  argument in the lowest bits, giving its size on the wire. Each
+  message is sent as
+
+    LOGTOK_SYNC id_hi id_lo args...
+
+  with arguments most significant byte first and strings NUL
+  terminated. A message is at most LOGTOK_MAX_MSG bytes, strings are
+  cut short to fit. Bytes outside a message are text, such as output
+  from the bootloader, and are passed through by logdecode
+ */
+
+#pragma once
+
+#define LOGTOK_SYNC      0xFE
+#define LOGTOK_MAX_MSG   64
+#define LOGTOK_MAX_ARGS  15
+#define LOGTOK_MAX_IDS   4096
+
+#define LOGTOK_ID(index, nargs) (((nargs)<<12) | (index))
+
+// argument types in spec
+#define LOGTOK_ARG_INT   0 // 2 bytes, %d %u %x %o %c
+#define LOGTOK_ARG_LONG  1 // 4 bytes, %ld %lu %lx %lo
+#define LOGTOK_ARG_CHAR  2 // 1 byte, %hd %hu %hx %ho
+#define LOGTOK_ARG_STR   3 // NUL terminated, %s
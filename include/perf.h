@@ -0,0 +1,36 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+  timing instrumentation, enabled with PERF_STATS. Phases are timed
+  from the free running 1MHz TIM2 counter, keeping min, max, count and
+  a histogram per phase. Begin and end must be called from the same
+  interrupt handler
+ */
+enum perf_id {
+    PERF_RADIO_IRQ  = 0, // cypress_irq()
+    PERF_ADC_IRQ    = 1, // adc_irq()
+    PERF_TICK_IRQ   = 2, // timer_irq(), the 1ms tick
+    PERF_PKT_BUILD  = 3, // building a packet in send_normal_packet()
+    PERF_PKT_TX     = 4, // channel setup and transmit queue of a send
+    PERF_SEND_JITTER = 5, // error of a send's start against its schedule
+};
+#define PERF_NUM_IDS 6
+
+// histogram buckets are powers of 2: <16us, <32us, ... >=1024us
+#define PERF_HIST_BUCKETS 8
+
+#if PERF_STATS
+void perf_init(void);
+void perf_begin(uint8_t id);
+void perf_end(uint8_t id);
+void perf_record(uint8_t id, uint16_t us);
+void perf_count_clip(void);
+uint16_t perf_max_us(uint8_t id);
+void perf_report(void);
+#define PERF_BEGIN(id) perf_begin(id)
+#define PERF_END(id) perf_end(id)
+#else
+#define PERF_BEGIN(id)
+#define PERF_END(id)
+#endif
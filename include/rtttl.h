@@ -0,0 +1,17 @@
+/*
+  pre-parsed RTTTL tunes
+ */
+#include <stdint.h>
+
+struct rtttl_note {
+    uint8_t note; // semitones from C4 plus one, zero for a pause
+    uint16_t duration_ms;
+};
+
+struct rtttl_tune {
+    const char *name;
+    const struct rtttl_note *notes;
+    uint8_t num_notes;
+};
+
+uint8_t rtttl_parse(const char *tune, struct rtttl_note *notes, uint8_t max_notes);
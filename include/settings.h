@@ -0,0 +1,20 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+  small settings cached in RAM. Settings are identified by their
+  EEPROM_* offset in the original fixed layout, EEPROM_DSMPROT_OFFSET
+  to EEPROM_FRAME_PROFILE. Reads come from RAM and changes are written
+  back lazily as records of a journal rotating through
+  EEPROM_JOURNAL_OFFSET, see settings.c
+ */
+#define SETTINGS_NUM 6
+
+// write changes once they have been stable this long
+#define SETTINGS_FLUSH_MS 3000
+
+void settings_init(void);
+uint8_t settings_get(uint8_t id);
+void settings_set(uint8_t id, uint8_t value);
+void settings_update(void);
+void settings_flush(void);
@@ -1,4 +1,5 @@
 void spi_init(void);
+void spi_set_clock_div(uint8_t br);
 void spi_write(uint8_t n, const uint8_t *buf);
 uint8_t spi_read1(void);
 void spi_transfer(uint8_t n, const uint8_t *sendbuf, uint8_t *recvbuf);
@@ -6,6 +7,24 @@ void spi_force_chip_select(bool set);
 void spi_read_registers(uint8_t reg, uint8_t *buf, uint8_t len);
 void spi_transfer(uint8_t n, const uint8_t *sendbuf, uint8_t *recvbuf);
 
+/*
+  a queued register write. The register byte is sent followed by
+  len bytes from data, or by value if data is NULL. Each write is
+  sent with its own chip select
+ */
+struct spi_write {
+    uint8_t reg;
+    uint8_t len;
+    uint8_t value;
+    const uint8_t *data;
+};
+
+typedef void (*spi_callback_t)(void);
+
+void spi_queue_start(const struct spi_write *writes, uint8_t count, spi_callback_t callback);
+void spi_queue_wait(void);
+bool spi_queue_busy(void);
+void spi_irq(void);
 
 
 
@@ -118,6 +118,18 @@ typedef unsigned long U32;
 #define FLASH_PUKR	*(volatile U8*)0x5062 // progmem unprotection
 #define FLASH_DUKR	*(volatile U8*)0x5064 // EEPROM unprotection
 
+#define FLASH_CR2_OPT (1 << 7)
+#define FLASH_CR2_WPRG (1 << 6)
+#define FLASH_CR2_ERASE (1 << 5)
+#define FLASH_CR2_FPRG (1 << 4)
+#define FLASH_CR2_PRG (1 << 0)
+
+#define FLASH_IAPSR_HVOFF (1 << 6)
+#define FLASH_IAPSR_DUL (1 << 3)
+#define FLASH_IAPSR_EOP (1 << 2)
+#define FLASH_IAPSR_PUL (1 << 1)
+#define FLASH_IAPSR_WR_PG_DIS (1 << 0)
+
 #define EEPROM_KEY1		0xAE  // keys to manage EEPROM's write access
 #define EEPROM_KEY2		0x56
 #define EEPROM_START_ADDR  (volatile U8*)0x4000
@@ -145,6 +157,15 @@ typedef unsigned long U32;
 #define CLK_HSITRIMR	*(volatile U8*)0x50CC
 #define CLK_SWIMCCR		*(volatile U8*)0x50CD
 
+#define CLK_SPCKENR1_TIM1 (1 << 7)
+#define CLK_SPCKENR1_TIM3 (1 << 6)
+#define CLK_SPCKENR1_TIM2 (1 << 5)
+#define CLK_SPCKENR1_TIM4 (1 << 4)
+#define CLK_SPCKENR1_UART2 (1 << 3)
+#define CLK_SPCKENR1_UART1 (1 << 2)
+#define CLK_SPCKENR1_SPI (1 << 1)
+#define CLK_SPCKENR1_I2C (1 << 0)
+
 /* ------------------- Watchdog ------------------ */
 #define WWDG_CR			*(volatile U8*)0x50D1
 #define WWDG_WR			*(volatile U8*)0x50D2
@@ -173,6 +194,21 @@ typedef unsigned long U32;
 #define SPI_CR1_MODE2           0x02
 #define SPI_CR1_MODE3           0x03
 
+/* SPI_ICR bits */
+#define SPI_ICR_TXIE (1 << 7)
+#define SPI_ICR_RXIE (1 << 6)
+#define SPI_ICR_ERRIE (1 << 5)
+#define SPI_ICR_WKIE (1 << 4)
+
+/* SPI_SR bits */
+#define SPI_SR_BSY (1 << 7)
+#define SPI_SR_OVR (1 << 6)
+#define SPI_SR_MODF (1 << 5)
+#define SPI_SR_CRCERR (1 << 4)
+#define SPI_SR_WKUP (1 << 3)
+#define SPI_SR_TXE (1 << 1)
+#define SPI_SR_RXNE (1 << 0)
+
 /* ------------------- I2C ------------------- */
 #define I2C_CR1			*(volatile U8*)0x5210
 #define I2C_CR2			*(volatile U8*)0x5211
@@ -324,6 +360,16 @@ typedef unsigned long U32;
 #define TIM_SR1_CC1IF (1 << 1)
 #define TIM_SR1_UIF (1 << 0)
 
+/* TIM_EGR bits */
+#define TIM_EGR_BG (1 << 7)
+#define TIM_EGR_TG (1 << 6)
+#define TIM_EGR_COMG (1 << 5)
+#define TIM_EGR_CC4G (1 << 4)
+#define TIM_EGR_CC3G (1 << 3)
+#define TIM_EGR_CC2G (1 << 2)
+#define TIM_EGR_CC1G (1 << 1)
+#define TIM_EGR_UG (1 << 0)
+
 /* TIM2 */
 #define TIM2_CR1	*(volatile U8*)0x5300
 #if defined STM8S105 || defined STM8S103
@@ -448,6 +494,21 @@ typedef unsigned long U32;
 #define ADC_AWCRH	*(volatile U8*)0x540E
 #define ADC_AWCRL	*(volatile U8*)0x540F
 
+#define ADC_CSR_EOC (1 << 7)
+#define ADC_CSR_AWD (1 << 6)
+#define ADC_CSR_EOCIE (1 << 5)
+#define ADC_CSR_AWDIE (1 << 4)
+
+#define ADC_CR1_CONT (1 << 1)
+#define ADC_CR1_ADON (1 << 0)
+
+#define ADC_CR2_EXTTRIG (1 << 6)
+#define ADC_CR2_ALIGN (1 << 3)
+#define ADC_CR2_SCAN (1 << 1)
+
+#define ADC_CR3_DBUF (1 << 7)
+#define ADC_CR3_OVR (1 << 6)
+
 /* ------------------- swim control ------------------- */
 #define CFG_GCR			*(volatile U8*)0x7F60
 #define SWIM_CSR		*(volatile U8*)0x7F80
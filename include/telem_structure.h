@@ -9,11 +9,38 @@ enum telem_type {
     TELEM_STATUS= 0, // a telem_status packet
     TELEM_PLAY  = 1, // play a tune
     TELEM_FW    = 2, // update new firmware
+    TELEM_FW_WINDOW = 3, // update new firmware, windowed
 };
 
+/*
+  TELEM_FW_WINDOW packets carry whole 8 byte chunks of a 128 byte
+  flash block, which may be sent without waiting for acks. The last
+  block is padded to a whole block. The chunks received for the
+  current block are reported in TXTELEM_FW_WINDOW uplink records,
+  which carry the block number and the 16 bit chunk bitmap, so a
+  receiver using windowed transfers must decode uplink records and
+  set TELEM_FLAG_UPLINK.
+  Missing chunks are resent, and the next block is started once all
+  16 bits are set.
+
+  Channel 8 extra data key 7 values are told apart by their top bits:
+    0bbbbbbb  OTA resume block
+    100nnnnn  TX noise floor RSSI (0 to 31) of the packet's channel
+    110ppppp  TX frame rate profile, 0 for 8ms, 1 for 22ms
+    111jjjjj  worst recent send jitter in 32us units, saturating at
+              31, PERF_STATS builds only
+  101xxxxx is unused. The resume block is the first 128 byte block of
+  the new firmware slot not yet written (127 if none) for the image
+  whose header was last written at offset 0. The progress survives
+  power cycles, so an update can be resumed by resending the first
+  chunk, which carries the image header, then continuing from that
+  block. A different header starts again from block 0
+ */
+
 #define TELEM_FLAG_GPS_OK  (1U<<0)
 #define TELEM_FLAG_ARM_OK  (1U<<1)
 #define TELEM_FLAG_BATT_OK (1U<<2)
+#define TELEM_FLAG_UPLINK  (1U<<3) // RX decodes uplink records, see telem_tx_status
 #define TELEM_FLAG_ARMED   (1U<<4)
 #define TELEM_FLAG_POS_OK  (1U<<5)
 #define TELEM_FLAG_VIDEO   (1U<<6)
@@ -58,14 +85,40 @@ struct telem_packet {
 
 
 enum tx_telem_type {
-    TXTELEM_RSSI = 0,
+    TXTELEM_RSSI = 0, // telem RSSI in bits 7:0, telem pps in bits 15:8
     TXTELEM_CRC1 = 1,
     TXTELEM_CRC2 = 2,
+    TXTELEM_ACK = 3, // OTA ack seq in bits 15:8, resume block in bits 7:0
+    TXTELEM_NOISE = 4, // noise floor RSSI of hop 0 in bits 7:0, hop 1 in bits 15:8
+    TXTELEM_POWER = 5, // TX power level in bits 7:0, link loss in bits 15:8
+    TXTELEM_BUILD = 6, // build date, bits 15:9 year-2017, 8:5 month, 4:0 day
+    TXTELEM_VERSION = 7, // bootloader version in bits 7:0, frame profile in bits 15:8
 };
 
 /*
-  tx_status structure sent one byte at a time to RX. This is packed
-  into channels 8, 9 and 10 (using 32 bits of a possible 33)
+  windowed transfer status: types with bit 7 set carry the chunk
+  bitmap of the block in bits 6:0 of the type
+ */
+#define TXTELEM_FW_WINDOW 0x80
+
+/*
+  tx_status structure sent to RX. This is packed into the channels
+  with ids 8, 9 and 10 in the packet (channels 9 to 11, as channel 8
+  extra data has id 7), using 32 bits of a possible 33, as
+  crc:type:data most significant bits first: id 8 holds bits 31:21, id
+  9 bits 20:10 and id 10 bits 9:0. crc is the inverted CRC8 (polynomial
+  0x07, initial value 0) of type and data, data high byte first, so
+  all zero channels are not a valid record. The three
+  ids replace ids 4, 5 and 7 in three of every four packets that would
+  carry channel 8 extra data, so a record is only valid when all three
+  came in the same packet and the crc matches.
+
+  Records are only sent while the last telem_status from the receiver
+  has TELEM_FLAG_UPLINK set, so receivers that don't decode them keep
+  ids 8 to 10 and every channel 8 extra data packet.
+
+  Records come in priority order: OTA acks and windowed transfer
+  status first, then link stats, then build information, see uplink.c
  */
 struct telem_tx_status {
     uint8_t crc;
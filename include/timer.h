@@ -1,8 +1,38 @@
 #include <stdint.h>
+#include <stdbool.h>
 
 void timer_init(void);
 void timer_irq(void);
+void timer2_irq(void);
 uint32_t timer_get_ms(void);
 typedef void (*timer_callback_t)(void);
-void timer_call_after_ms(uint16_t dt_ms, timer_callback_t callback);
 void timer_delay_ms(uint16_t ms);
+void timer_idle(void);
+uint8_t timer_idle_percent(void);
+
+/*
+  scheduler slots. Each slot holds one pending callback, so users of
+  different slots can't steal each others deadlines
+ */
+enum timer_slot {
+    TIMER_SLOT_RADIO  = 0,
+    TIMER_SLOT_BUZZER = 1,
+    TIMER_SLOT_NOISE  = 2,
+};
+#define TIMER_NUM_SLOTS 3
+
+// a callback more than this late is counted as late
+#define TIMER_LATE_US 50
+
+struct timer_stats {
+    uint16_t calls;
+    uint16_t late_count;
+    uint16_t max_late_us;
+    uint16_t max_run_us;
+};
+
+void timer_call_after_us(uint8_t slot, uint32_t dt_us, timer_callback_t callback);
+void timer_call_next_us(uint8_t slot, uint32_t dt_us, timer_callback_t callback);
+void timer_cancel(uint8_t slot);
+bool timer_pending(uint8_t slot);
+struct timer_stats *timer_get_stats(uint8_t slot);
@@ -5,3 +5,10 @@ void uart1_write(const char *str);
 void uart2_init(void);
 void uart2_write(const char *str);
 void uart2_putchar(char c);
+void uart2_write_block(const uint8_t *buf, uint8_t len);
+void uart2_tx_irq(void);
+void uart2_flush(void);
+uint16_t uart2_tx_dropped(void);
+void uart2_set_baudrate(uint32_t baudrate);
+void uart2_enable_rx(void);
+bool uart2_read(uint8_t *c);
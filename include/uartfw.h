@@ -0,0 +1,32 @@
+/*
+  UART firmware load protocol. This header is common to the
+  transmitter and the uartload host tool
+
+  The host sends the blimage format image (size/CRC header then the
+  firmware) to the NEW_FIRMWARE_BASE slot in frames of one flash
+  block:
+
+    UARTFW_SYNC1 UARTFW_SYNC2 offset_hi offset_lo len data[len] crc8
+
+  where offset is a multiple of UARTFW_BLOCK_SIZE and the crc8 covers
+  offset, len and data. A frame with len zero ends the transfer. Each
+  frame is answered with:
+
+    UARTFW_SYNC1 UARTFW_SYNC2 status offset_hi offset_lo
+
+  with status UARTFW_ACK or UARTFW_NAK. The end frame is acked only if
+  the image in the slot has a valid size and CRC, after which the
+  transmitter resets so the bootloader can apply it
+ */
+
+#pragma once
+
+#define UARTFW_BAUDRATE   115200
+#define UARTFW_SYNC1      0x55
+#define UARTFW_SYNC2      0xAA
+#define UARTFW_ACK        0x06
+#define UARTFW_NAK        0x15
+#define UARTFW_BLOCK_SIZE 128
+#define UARTFW_HEADER_LEN 5
+
+void uartfw_load(void);
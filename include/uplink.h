@@ -0,0 +1,14 @@
+#include <stdint.h>
+
+/*
+  uplink records to the receiver, sent as channel ids 8 to 10 in place of
+  the button and extra data channels, see telem_structure.h
+ */
+#define UPLINK_FIRST_CHANNEL 8
+
+// one in this many packets that would carry channel 8 extra data
+// keeps it, the others carry a record
+#define UPLINK_EXTRA_SHARE 4
+
+void uplink_next_record(void);
+uint16_t uplink_channel_value(uint8_t chan);
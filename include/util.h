@@ -23,6 +23,11 @@ uint32_t millis(void);
 
 uint16_t get_random16(void);
 
+#if LOG_TOKENS
+// printf calls are replaced by log_token calls at build time, see logtok.h
+void log_token(uint16_t id, uint32_t spec, ...);
+#else
 void printf(const char *fmt, ...);
+#endif
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
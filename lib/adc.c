@@ -1,46 +1,117 @@
 #include "stm8l.h"
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 #include <util.h>
+#include <config.h>
+#include <adc.h>
 
-#define NUM_CHANS 4
-static uint8_t chan=0;
-static bool take_next;
-static uint16_t values[NUM_CHANS];
+/*
+  the ADC scans AIN0 to AIN3 into the data buffer registers, one scan
+  per end of conversion interrupt. Each scan is accumulated and every
+  2^ADC_OVERSAMPLE_SHIFT scans the averages are published to one half
+  of a double buffer, so readers always see a complete set of stick
+  values sampled at the same time.
+
+  A batch of scans is started from the 1ms timer tick rather than
+  running continuously, so the CPU can sleep between ticks
+ */
+
+#define OVERSAMPLE_COUNT (1U<<ADC_OVERSAMPLE_SHIFT)
+
+static uint16_t sums[ADC_NUM_CHANS];
+static uint8_t scan_count;
+
+static struct adc_snapshot snapshots[2];
+static volatile uint8_t snap_idx;
+static volatile uint8_t snap_seq;
+static volatile bool batch_done;
 
 void adc_irq(void)
 {
-    if (take_next) {
-        /*
-          wait a full ADC cycle before grabbing the next value, or
-          sometimes we get a stale value. Thanks to Bill for noticing
-          this in testing.
-         */
-        uint16_t v;
-        v = ADC_DRL;
-        v |= ADC_DRH << 8;
-        values[chan] = v;
-        chan = (chan + 1) & (NUM_CHANS-1);
+    uint16_t v;
+
+    // right aligned, so the low byte must be read first
+    v = ADC_DB0RL;
+    v |= ADC_DB0RH << 8;
+    sums[0] += v;
+    v = ADC_DB1RL;
+    v |= ADC_DB1RH << 8;
+    sums[1] += v;
+    v = ADC_DB2RL;
+    v |= ADC_DB2RH << 8;
+    sums[2] += v;
+    v = ADC_DB3RL;
+    v |= ADC_DB3RH << 8;
+    sums[3] += v;
+
+    // clear EOC & AWD flags
+    ADC_CSR &= ~(ADC_CSR_EOC | ADC_CSR_AWD);
+    ADC_CR3 &= ~ADC_CR3_OVR;
+
+    if (++scan_count < OVERSAMPLE_COUNT) {
+        // start the next scan of this batch
+        ADC_CR1 |= ADC_CR1_ADON;
+    } else {
+        // publish into the buffer readers are not using
+        uint8_t i;
+        uint8_t idx = snap_idx ^ 1;
+        for (i=0; i<ADC_NUM_CHANS; i++) {
+            snapshots[idx].value[i] = sums[i] >> ADC_OVERSAMPLE_SHIFT;
+            sums[i] = 0;
+        }
+        snapshots[idx].seq = snap_seq + 1;
+        snap_idx = idx;
+        snap_seq++;
+        scan_count = 0;
+        batch_done = true;
     }
-    ADC_CSR &= 0x3f; // clear EOC & AWD flags
-    ADC_CSR = 0x20 | chan;
+}
 
-    take_next = !take_next;
+/*
+  start the next batch of scans. Called from the 1ms timer tick, does
+  nothing until adc_init() has run or while a batch is in progress
+ */
+void adc_start(void)
+{
+    if (batch_done) {
+        batch_done = false;
+        ADC_CR1 |= ADC_CR1_ADON;
+    }
 }
 
 void adc_init(void)
 {
     // Configure ADC
-    // select PD2[AIN3] & enable interrupt for EOC
-    ADC_CSR = 0x23;
+    // scan AIN0 to AIN3 & enable interrupt for EOC
+    ADC_CSR = ADC_CSR_EOCIE | (ADC_NUM_CHANS-1);
     ADC_TDRL = 0x08; // disable Schmitt triger for AIN3
-    // right alignment
-    ADC_CR2 = 0x08; // don't forget: first read ADC_DRL!
-    // f_{ADC} = f/18 & continuous non-buffered conversion & wake it up
-    ADC_CR1 = 0x73;
-    ADC_CR1 = 0x73; // turn on ADC (this needs second write operation)
+    // right alignment, scan mode
+    ADC_CR2 = ADC_CR2_ALIGN | ADC_CR2_SCAN; // don't forget: first read ADC_DRL!
+    // buffered conversions into ADC_DBxR
+    ADC_CR3 = ADC_CR3_DBUF;
+    // f_{ADC} = f/18 & single scan per trigger & wake it up
+    ADC_CR1 = 0x70 | ADC_CR1_ADON;
+    delay_us(7); // ADC stabilisation time
+    ADC_CR1 = 0x70 | ADC_CR1_ADON; // start first scan (this needs second write operation)
 }
 
+/*
+  return the latest value for one channel
+ */
 uint16_t adc_value(uint8_t chan)
 {
-    return values[chan];
+    return snapshots[snap_idx].value[chan];
+}
+
+/*
+  get a coherent copy of the latest set of channel values
+ */
+void adc_get_snapshot(struct adc_snapshot *snap)
+{
+    uint8_t seq;
+    do {
+        seq = snap_seq;
+        memcpy(snap, &snapshots[snap_idx], sizeof(*snap));
+    } while (seq != snap_seq);
 }
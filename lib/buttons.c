@@ -0,0 +1,64 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <gpio.h>
+#include <config.h>
+#include <buttons.h>
+
+/*
+  button pins. All but the power button are pulled up and read low
+  when pressed
+ */
+static const struct button_pin {
+    uint16_t pin;
+    uint8_t button;
+} button_pins[] = {
+    { PIN_LEFT_BUTTON,  BUTTON_LEFT },
+    { PIN_RIGHT_BUTTON, BUTTON_RIGHT },
+    { PIN_SW1,          BUTTON_LEFT_SHOULDER },
+    { PIN_SW2,          BUTTON_RIGHT_SHOULDER },
+    { PIN_USER,         BUTTON_POWER },
+};
+#define ACTIVE_LOW (BUTTON_LEFT|BUTTON_RIGHT|BUTTON_LEFT_SHOULDER|BUTTON_RIGHT_SHOULDER)
+
+// the buttons are on ports A to E
+#define NUM_PORTS 5
+
+/*
+  debounced state and a two bit vertical counter per button. A button
+  changes state once its input has differed from the state for 4
+  ticks in a row
+ */
+static volatile uint8_t buttons;
+static uint8_t count0, count1;
+
+/*
+  sample and debounce the buttons. Called from the 1ms tick
+ */
+void buttons_tick(void)
+{
+    uint8_t idr[NUM_PORTS];
+    uint8_t raw = 0;
+    uint8_t delta;
+    uint8_t i;
+
+    for (i=0; i<NUM_PORTS; i++) {
+        idr[i] = gpio_read_port(i);
+    }
+    for (i=0; i<sizeof(button_pins)/sizeof(button_pins[0]); i++) {
+        const struct button_pin *b = &button_pins[i];
+        if (idr[b->pin>>8] & b->pin & 0xFF) {
+            raw |= b->button;
+        }
+    }
+    raw ^= ACTIVE_LOW;
+
+    delta = raw ^ buttons;
+    count1 = (count1 ^ count0) & delta;
+    count0 = ~count0 & delta;
+    buttons ^= delta & ~(count0 | count1);
+}
+
+uint8_t get_buttons(void)
+{
+    return buttons;
+}
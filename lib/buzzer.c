@@ -4,56 +4,45 @@
 #include <gpio.h>
 #include <eeprom.h>
 #include <timer.h>
-#include <uart.h>
+#include <rtttl.h>
 #include <string.h>
 
 #define OPTION_BYTE2 *(volatile uint8_t *)0x4803
 #define OPTION_NBYTE2 *(volatile uint8_t *)0x4804
 
-#define isdigit(c) ((c)>='0' && (c)<='9')
-
 /*
-  tune playing code based on ToneAlarm code from ArduPilot
+  tune playing code based on ToneAlarm code from ArduPilot. The built
+  in tunes are converted into note tables at build time by mktunes,
+  and are played from the buzzer timer slot so callers don't block
  */
 
-static uint8_t state;
-static int8_t tune_num;
-static uint8_t tune_pos;
-static int8_t prev_tune_num;
-static bool tune_changed;
-static uint16_t cur_note;
-static uint16_t prev_time;
-static uint16_t duration;
-static bool tune_comp;
-static uint16_t wholenote;
-static uint8_t default_oct;
-static uint8_t default_dur;
-static uint16_t bpm;
-
-// List of RTTTL tones
-static const char * const tune[TONE_NUMBER_OF_TUNES] = {
-    "Startup:d=8,o=6,b=480:a,d7,c7,a,d7,c7,a,d7,16d7,16c7,16d7,16c7,16d7,16c7,16d7,16c7",
-    "Error:d=4,o=6,b=400:8a,8a,8a,p,a,a,a,p",
-    "notify_pos:d=4,o=6,b=400:8e,8e,a",
-    ":d=1,o=4,b=2048:b",
-    "loiter:d=4,o=6,b=400:8d,8d,a",
-    "althold:d=4,o=6,b=400:8e,8e,8e,c",
-    "rtl:d=4,o=6,b=400:8c,8c,8c,d,8c,8c,8c,d",
-    "land:d=4,o=6,b=400:d,4b,4b,4b,4b",
-    "other_mode:d=4,o=6,b=400:4c,4b,4a",
-    "batt_warning:d=4,o=1,b=512:d,d,d,d",
-    "inactivity:d=4,o=6,b=512:8c,8c,8c,8c,8c",
-    "video:d=4,o=6,b=600:8b",
-    "disarm:d=4,o=6,b=400:8c,p,8c"
-};
-
-static const char *tune_ptr;
+#include "tunes.h"
 
 // allow for uploaded tunes for development of new tunes
 #define MAX_TUNE_LEN 90
+#define MAX_TUNE_NOTES (MAX_TUNE_LEN/2)
 static uint8_t temp_tune[MAX_TUNE_LEN+1];
 static uint8_t temp_tune_len;
-static bool temp_tune_pending;
+// set when a whole tune has arrived and is waiting to be parsed
+static bool temp_tune_ready;
+static struct rtttl_note temp_notes[MAX_TUNE_NOTES];
+static struct rtttl_tune temp_rtttl_tune = { (const char *)temp_tune, temp_notes, 0 };
+
+// silence between notes, so repeated notes are heard separately
+#define NOTE_GAP_MS 2
+
+/*
+  tunes waiting to be played. buzzer_tune() adds at the tail from the
+  main loop, and the buzzer timer callback takes from the head
+ */
+#define TUNE_QUEUE_LEN 4
+static volatile uint8_t tune_queue[TUNE_QUEUE_LEN];
+static volatile uint8_t tune_queue_head;
+static volatile uint8_t tune_queue_tail;
+
+static const struct rtttl_tune *playing_tune;
+static uint8_t note_pos;
+static bool note_on;
 
 
 // map 49 tones onto 30 available frequencies. Thanks to Carl for the
@@ -154,222 +143,52 @@ static void stop_note(void)
 }
 
 /*
-  continue playing note until duration is reached
+  find the notes for a tune number
  */
-static bool play()
+static const struct rtttl_tune *get_tune(uint8_t t)
 {
-    uint16_t cur_time = timer_get_ms();
-    if (tune_num != prev_tune_num){
-        tune_changed = true;
-        return true;
+    if (t == TONE_PENDING) {
+        return &temp_rtttl_tune;
     }
-    if (cur_note != 0) {
-        play_note(cur_note);
-        cur_note =0;
-        prev_time = cur_time;
+    if (t < NUM_BUILTIN_TUNES) {
+        return &builtin_tunes[t];
     }
-    if ((cur_time - prev_time) > duration){
-        stop_note();
-        if(tune_ptr[tune_pos] == '\0'){
-            tune_num = -1;
-            tune_pos = 0;
-            tune_comp = true;
-            return false;
-        }
-        return true;
-    }
-    return false;
+    printf("Bad tune %u\n", t);
+    return NULL;
 }
 
 /*
-  setup note and duration
+  buzzer timer callback, start the next note or the next queued tune
  */
-static bool set_note()
+static void tune_next(void)
 {
-    // first, get note duration, if available
-    uint16_t scale,note,num =0;
-    char c;
+    const struct rtttl_note *n;
 
-    if (tune_num < 0) {
-        return false;
-    }
-    
-    duration = 0;
-
-    while (isdigit(tune_ptr[tune_pos])) {
-        //this is a safe while loop as it can't go further than
-        //the length of the rtttl tone string
-        num = (num * 10) + (tune_ptr[tune_pos++] - '0');
-    }
-    if (num) {
-        duration = wholenote / num;
-    } else {
-        duration = wholenote / 4;  // we will need to check if we are a dotted note after
-    }
-    
-    // now get the note
-    note = 0;
-    c = tune_ptr[tune_pos];
-
-    switch (c) {
-    case 'c':
-        note = 1;
-        break;
-    case 'd':
-        note = 3;
-        break;
-    case 'e':
-        note = 5;
-        break;
-    case 'f':
-        note = 6;
-        break;
-    case 'g':
-        note = 8;
-        break;
-    case 'a':
-        note = 10;
-        break;
-    case 'b':
-        note = 12;
-        break;
-    case 'p':
-    default:
-        note = 0;
-    }
-
-    tune_pos++;
-
-    // now, get optional '#' sharp
-    if (tune_ptr[tune_pos] == '#'){
-        note++;
-        tune_pos++;
-    }
-
-    // now, get optional '.' dotted note
-    if (tune_ptr[tune_pos] == '.'){
-        duration += duration/2;
-        tune_pos++;
-    }
-
-    // now, get scale
-    if (isdigit(tune_ptr[tune_pos])) {
-        scale = tune_ptr[tune_pos] - '0';
-        tune_pos++;
-    } else{
-        scale = default_oct;
-    }
-
-    if (tune_ptr[tune_pos] == ',') {
-        tune_pos++;       // skip comma for next note (or we may be at the end)
-    }
-    // now play the note
-
-    if(note){
-        if(tune_changed == true){
-            tune_pos = 0;
-            tune_changed = false;
-        }
-        cur_note = (scale - 4) * 12 + note;
-        return true;
-    } else{
-        cur_note = 0;
-        return true;
-    }
-
-}
-
-/*
-  initialise state for tune_num
- */
-static bool init_tune()
-{
-    uint16_t num;
-    bool have_name;
-    
-    default_dur = 4;
-    default_oct = 6;
-    bpm = 63;
-    prev_tune_num = tune_num;
-
-    have_name = (tune_ptr[tune_pos] != ':');
-    if (have_name) {
-        printf("Playing tune '");
-    }
-    
-    tune_comp = false;
-    while (tune_ptr[tune_pos] != ':') {
-        if (tune_ptr[tune_pos] == '\0') {
-            return false;
-        }
-        uart2_putchar(tune_ptr[tune_pos]);
-        tune_pos++;
-    }
-    if (have_name) {
-        printf("'\n");
-    }
-    tune_pos++;
-
-    if (tune_ptr[tune_pos] == 'd'){
-        tune_pos+=2;
-        num = 0;
-
-        while(isdigit(tune_ptr[tune_pos])){
-            num = (num * 10) + (tune_ptr[tune_pos++] - '0');
-        }
-        if(num > 0){
-            default_dur = num;
-        }
-        tune_pos++;                   // skip comma
-    }
-
-
-    // get default octave
-
-    if(tune_ptr[tune_pos] == 'o')
-    {
-        tune_pos+=2;              // skip "o="
-        num = tune_ptr[tune_pos++] - '0';
-        if(num >= 3 && num <=7){
-            default_oct = num;
-        }
-        tune_pos++;                   // skip comma
+    if (note_on) {
+        // gap between notes
+        stop_note();
+        note_on = false;
+        timer_call_next_us(TIMER_SLOT_BUZZER, NOTE_GAP_MS*1000UL, tune_next);
+        return;
     }
 
-    // get BPM
-
-    if(tune_ptr[tune_pos] == 'b'){
-        tune_pos+=2;              // skip "b="
-        num = 0;
-        while(isdigit(tune_ptr[tune_pos])){
-            num = (num * 10) + (tune_ptr[tune_pos++] - '0');
+    while (playing_tune == NULL || note_pos >= playing_tune->num_notes) {
+        if (tune_queue_head == tune_queue_tail) {
+            // all done
+            playing_tune = NULL;
+            return;
         }
-        bpm = num;
-        tune_pos++;                   // skip colon
+        playing_tune = get_tune(tune_queue[tune_queue_head]);
+        tune_queue_head = (tune_queue_head+1) % TUNE_QUEUE_LEN;
+        note_pos = 0;
     }
 
-    wholenote = (60 * ((uint32_t)1000) / bpm) * 4; 
-    return true;
-}
-
-/*
-  advance state machine by one tick
- */
-static void tune_tick()
-{
-    if(state == 0) {
-        state = state + init_tune();
-    } else if (state == 1) {
-        state = state + set_note();
-    }
-    if (state == 2) {
-        state = state + play();
-    } else if (state == 3) {
-        state = 1;
-    }
-    if (tune_comp) {
-        state = 0;
+    n = &playing_tune->notes[note_pos++];
+    if (n->note != 0) {
+        play_note(n->note);
+        note_on = true;
     }
+    timer_call_next_us(TIMER_SLOT_BUZZER, n->duration_ms*1000UL, tune_next);
 }
 
 void buzzer_init(void)
@@ -384,24 +203,54 @@ void buzzer_init(void)
 }
 
 /*
-  play the given tune number. See buzzer.h for tunes
+  play the given tune number. See buzzer.h for tunes. The tune is
+  queued to be played from the buzzer timer slot once any earlier
+  tunes finish
  */
 void buzzer_tune(uint8_t t)
 {
-    tune_num = t;
-    if (t == TONE_PENDING) {
-        tune_ptr = (const char *)temp_tune;
-    } else if (t < TONE_NUMBER_OF_TUNES) {
-        tune_ptr = tune[t];
-    } else {
-        printf("Bad tune %u\n", t);
+    const struct rtttl_tune *tune = get_tune(t);
+    uint8_t next_tail = (tune_queue_tail+1) % TUNE_QUEUE_LEN;
+    if (tune == NULL || next_tail == tune_queue_head) {
+        // bad tune, or queue full
+        return;
+    }
+    if (tune->name[0]) {
+        printf("Playing tune '%s'\n", tune->name);
+    }
+    tune_queue[tune_queue_tail] = t;
+    tune_queue_tail = next_tail;
+
+    // if the callback is pending it will pick up the new tune
+    if (!timer_pending(TIMER_SLOT_BUZZER)) {
+        timer_call_after_us(TIMER_SLOT_BUZZER, 0, tune_next);
+    }
+}
+
+/*
+  play a tune, waiting for it to finish. This is for use where timer
+  interrupts can't run, such as on power off
+ */
+void buzzer_tune_blocking(uint8_t t)
+{
+    const struct rtttl_tune *tune = get_tune(t);
+    uint8_t i;
+
+    timer_cancel(TIMER_SLOT_BUZZER);
+    stop_note();
+    note_on = false;
+    playing_tune = NULL;
+
+    if (tune == NULL) {
         return;
     }
-    state = 0;
-    tune_comp = 0;
-    while (!tune_comp) {
-        tune_tick();
-        delay_ms(1);
+    for (i=0; i<tune->num_notes; i++) {
+        if (tune->notes[i].note != 0) {
+            play_note(tune->notes[i].note);
+        }
+        delay_ms(tune->notes[i].duration_ms);
+        stop_note();
+        delay_ms(NOTE_GAP_MS);
     }
 }
 
@@ -410,21 +259,36 @@ void buzzer_tune_add(uint16_t offset, const uint8_t *data, uint8_t length)
     if (offset + length > MAX_TUNE_LEN) {
         return;
     }
+    // a new upload replaces a tune still waiting to be parsed
+    temp_tune_ready = false;
     memcpy(&temp_tune[offset], data, length);
     temp_tune_len = offset+length;
     if (length < 8 || temp_tune_len == MAX_TUNE_LEN) {
         // must be the end of the tune
         temp_tune[temp_tune_len] = 0;
         printf("tune of length %u: %s\n", temp_tune_len, (const char *)temp_tune);
-        temp_tune_pending = true;
+        temp_tune_ready = true;
     }
 }
 
+/*
+  parse and play an uploaded tune. Called from the main loop, the tune
+  waits here while the last uploaded tune is still playing, so its
+  notes don't change under the player
+ */
 void buzzer_play_pending(void)
 {
-    if (!temp_tune_pending) {
+    char *name_end;
+
+    if (!temp_tune_ready || playing_tune == &temp_rtttl_tune) {
         return;
     }
-    temp_tune_pending = false;
+    temp_tune_ready = false;
+    // parse once, then keep just the name for printing
+    temp_rtttl_tune.num_notes = rtttl_parse((const char *)temp_tune, temp_notes, MAX_TUNE_NOTES);
+    name_end = strchr((char *)temp_tune, ':');
+    if (name_end != NULL) {
+        *name_end = 0;
+    }
     buzzer_tune(TONE_PENDING);
 }
@@ -5,12 +5,19 @@
 #include "util.h"
 #include "channels.h"
 #include "cypress.h"
+#include "eeprom.h"
+#include "perf.h"
+#include "buttons.h"
+#include "uplink.h"
 
 static const uint8_t stick_map[4] = { STICK_THROTTLE, STICK_ROLL, STICK_PITCH, STICK_YAW };
 extern uint8_t telem_ack_value;
 static uint8_t last_telem_ack_value;
 static uint8_t telem_ack_send_count;
 static uint8_t telem_extra_type;
+static struct adc_snapshot sticks;
+static uint8_t buttons;
+static uint16_t curves[CURVE_NUM_AXES][CURVE_POINTS];
 
 extern uint8_t get_bl_version(void);
 
@@ -30,7 +37,7 @@ static bool latched_left_button(void)
       does not change
      */
     
-    if (gpio_get(PIN_LEFT_BUTTON) != 0) {
+    if ((buttons & BUTTON_LEFT) == 0) {
         if (counter >= 10 && !ignore_left_button) {
             latched = !latched;
         }
@@ -40,10 +47,7 @@ static bool latched_left_button(void)
         if (counter < 11) {
             counter++;
         }
-        if (gpio_get(PIN_SW1)==0 ||
-            gpio_get(PIN_SW2)==0 ||
-            gpio_get(PIN_USER)!=0 ||
-            gpio_get(PIN_RIGHT_BUTTON)==0) {
+        if (buttons & ~BUTTON_LEFT) {
             ignore_left_button = true;
         }
         if (ignore_left_button) {
@@ -53,6 +57,73 @@ static bool latched_left_button(void)
     return latched;
 }
 
+/*
+  the default curve, matching the original linear stick scaling
+ */
+static uint16_t default_curve_point(uint8_t i)
+{
+    return CURVE_LINEAR(i * CURVE_STEP);
+}
+
+/*
+  load the stick curves from EEPROM into RAM, falling back to the
+  default linear curve if they are not valid
+ */
+void channels_init(void)
+{
+    uint16_t ofs = EEPROM_CURVE_OFFSET+1;
+    uint8_t a, i;
+    bool valid = (eeprom_read(EEPROM_CURVE_OFFSET) == CURVE_MAGIC);
+
+    for (a=0; a<CURVE_NUM_AXES; a++) {
+        for (i=0; i<CURVE_POINTS; i++) {
+            uint16_t v = (eeprom_read(ofs)<<8) | eeprom_read(ofs+1);
+            if (v > 2047) {
+                valid = false;
+            }
+            curves[a][i] = v;
+            ofs += 2;
+        }
+    }
+    if (!valid) {
+        for (i=0; i<CURVE_POINTS; i++) {
+            uint16_t v = default_curve_point(i);
+            for (a=0; a<CURVE_NUM_AXES; a++) {
+                curves[a][i] = v;
+            }
+        }
+    }
+    printf("Curves: %s\n", valid?"eeprom":"default");
+}
+
+/*
+  map a 0 to 1000 stick value through the curve for a channel
+ */
+static uint16_t curve_lookup(uint8_t chan, uint16_t v)
+{
+    const uint16_t *c = &curves[chan][v >> CURVE_SHIFT];
+    uint8_t frac = v & (CURVE_STEP-1);
+    int16_t delta = c[1] - c[0];
+    return c[0] + (int16_t)(((int32_t)delta * frac) >> CURVE_SHIFT);
+}
+
+/*
+  latch the sticks and buttons for the next packet, so all channels in
+  a packet come from the same ADC snapshot and button state
+ */
+void channels_sample(void)
+{
+    adc_get_snapshot(&sticks);
+    buttons = get_buttons();
+}
+
+// number of values sharing channel 8 key 7
+#if PERF_STATS
+#define KEY7_NUM_TYPES 4
+#else
+#define KEY7_NUM_TYPES 3
+#endif
+
 /*
   return an 11 bit channel output value
  */
@@ -66,7 +137,7 @@ uint16_t channel_value(uint8_t chan)
     case 2:
     case 3: {
         uint8_t stick = stick_map[chan];
-        v = adc_value(stick);
+        v = sticks.value[stick];
         if (v > 1000) {
             v = 1000;
         }
@@ -74,28 +145,28 @@ uint16_t channel_value(uint8_t chan)
             // fix reversals
             v = 1000 - v;
         }
-        break;
+        return curve_lookup(chan, v);
     }
     case 4:
         v = latched_left_button()?1000:0;
-        if (!gpio_get(PIN_LEFT_BUTTON)) {
+        if (buttons & BUTTON_LEFT) {
             // this allows for long-press vs short-press actions
             v += 100;
         }
         break;
     case 5:
-        v = gpio_get(PIN_RIGHT_BUTTON)==0?1000:0;
+        v = (buttons & BUTTON_RIGHT)?1000:0;
         break;
     case 6:
         // encode 3 switches onto channel 7
         v = 0;
-        if (gpio_get(PIN_SW1)==0) {
+        if (buttons & BUTTON_LEFT_SHOULDER) {
             v |= 1;
         }
-        if (gpio_get(PIN_SW2)==0) {
+        if (buttons & BUTTON_RIGHT_SHOULDER) {
             v |= 2;
         }
-        if (gpio_get(PIN_USER)!=0) {
+        if (buttons & BUTTON_POWER) {
             v |= 4;
         }
         v *= 100;
@@ -103,7 +174,7 @@ uint16_t channel_value(uint8_t chan)
     case 7: {
         uint8_t tvalue=0;
         /* return extra data in channel 8. Use top 3 bits for data type */
-        telem_extra_type = (telem_extra_type+1) % 7;
+        telem_extra_type = (telem_extra_type+1) % 8;
 
         if (telem_extra_type == 0 ||
             telem_ack_value != last_telem_ack_value ||
@@ -141,37 +212,41 @@ uint16_t channel_value(uint8_t chan)
             // bl version
             tvalue = get_bl_version();
             break;
+        case 7: {
+            static uint8_t key7_type;
+            key7_type = (key7_type + 1) % KEY7_NUM_TYPES;
+            if (key7_type == 0) {
+                // key 7 with top bit clear is the OTA resume block
+                tvalue = get_fw_resume_block();
+            } else if (key7_type == 1) {
+                // key 7 with top bits 100 is the noise floor RSSI of this packet's channel
+                tvalue = 0x80 | get_next_noise_floor();
+            } else if (key7_type == 2) {
+                // key 7 with top bits 110 is the frame rate profile
+                tvalue = 0xC0 | get_frame_profile();
+#if PERF_STATS
+            } else {
+                // key 7 with top bits 111 is the worst send jitter in 32us units
+                uint16_t jitter = perf_max_us(PERF_SEND_JITTER) >> 5;
+                tvalue = 0xE0 | (jitter > 0x1F ? 0x1F : jitter);
+#endif
+            }
+            break;
+        }
         }
 
         return (((uint16_t)telem_extra_type)<<8) | tvalue;
     }
+#if UPLINK_RECORDS
+    case 8:
+    case 9:
+    case 10:
+        return uplink_channel_value(chan);
+#endif
     }
 
     // map into 11 bit range
-    v = (((v - 500) * 27 / 32) + 512) * 2;
+    v = CURVE_LINEAR(v);
 
     return (uint16_t)v;
 }
-
-// get buttons
-uint8_t get_buttons(void)
-{
-    uint8_t ret = 0;
-
-    if (gpio_get(PIN_LEFT_BUTTON) == 0) {
-        ret |= BUTTON_LEFT;
-    }
-    if (gpio_get(PIN_RIGHT_BUTTON) == 0) {
-        ret |= BUTTON_RIGHT;
-    }
-    if (gpio_get(PIN_SW1)==0) {
-        ret |= BUTTON_LEFT_SHOULDER;
-    }
-    if (gpio_get(PIN_SW2)==0) {
-        ret |= BUTTON_RIGHT_SHOULDER;
-    }
-    if (gpio_get(PIN_USER)!=0) {
-        ret |= BUTTON_POWER;
-    }
-    return ret;
-}
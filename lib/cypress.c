@@ -21,6 +21,11 @@
 #include <telem_structure.h>
 #include <buzzer.h>
 #include "eeprom.h"
+#include "flash.h"
+#include <settings.h>
+#include <perf.h>
+#include <uplink.h>
+#include <cypress.h>
 
 #define DISABLE_CRC 0
 #if SUPPORT_DSMX
@@ -31,6 +36,18 @@
 
 #define DYNAMIC_POWER_ADJUSTMENT 1
 
+/*
+  the power controller runs once per telemetry slot. It steps up while
+  at least POWER_LOSS_UP of the last POWER_WINDOW slots were lost and
+  loss is still happening, and it moves towards the target averaged
+  telemetry RSSI after POWER_DOWN_HOLD slots without a change
+ */
+#define POWER_WINDOW 32
+#define POWER_LOSS_UP 3
+#define POWER_UP_HOLD 2
+#define POWER_DOWN_HOLD 128
+#define POWER_RSSI_SHIFT 3
+
 // if we have never seen a telemetry packet then we send a autobind
 // packet on channel 11 every 4 packets to allow for auto-bind
 #define AUTOBIND_CHANNEL 12
@@ -60,6 +77,39 @@ enum dsm_protocol {
     DSM_DSMX_2 = 0xB2,   // The original DSMX protocol with 2 packets of data
 };
 
+/*
+  frame rate profiles. A frame is two packets: the first is followed
+  by a short gap, the second by a long gap that holds the telemetry
+  receive slot. When the slot is shorter than the long gap the
+  receiver is closed at the end of the slot and the radio idles on the
+  next channel until the frame ends
+ */
+static const struct dsm_frame_profile {
+    uint16_t short_us;
+    uint16_t long_us;
+    uint16_t telem_us;
+    uint8_t autobind_sends; // sends between autobind packets
+    uint8_t dsm2_protocol;  // protocol advertised in bind packets
+    uint8_t dsmx_protocol;
+} frame_profiles[DSM_FRAME_NUM_PROFILES] = {
+    // DSM_FRAME_8MS, the original timing. This is already the lowest
+    // latency frame, so no separate low latency profile is added
+    { 2000, 6000, 6000, 4, DSM_DSM2_2, DSM_DSMX_2 },
+    // DSM_FRAME_22MS
+    { 2000, 20000, 6000, 2, DSM_DSM2_1, DSM_DSMX_1 },
+};
+
+static uint8_t frame_profile = DSM_FRAME_8MS;
+
+#if PERF_STATS
+// gap scheduled after the last send, 0 if there was no last send
+static uint16_t perf_gap_us;
+
+// when a telemetry window ends with the next send, it is checked for
+// a clipped packet this long before the send
+#define PERF_CLIP_CHECK_US 100
+#endif
+
 static struct stats {
     uint32_t bad_packets;
     uint32_t recv_errors;
@@ -262,6 +312,23 @@ enum {
 #define DSM_SCAN_MID_CH 40
 #define DSM_SCAN_MAX_CH 70
 
+/*
+  channel scan sampling. RSSI is read in bursts with chip select held.
+  A channel is dropped as soon as it reaches DSM_SCAN_NOISY_RSSI, and
+  the scan stops once two channels more than 10 apart have stayed at
+  or below DSM_SCAN_CLEAN_RSSI for all samples
+ */
+#define DSM_SCAN_SAMPLES 1500
+#define DSM_SCAN_BURST 16
+#define DSM_SCAN_NOISY_RSSI 8
+#define DSM_SCAN_CLEAN_RSSI 3
+
+/*
+  SOP and data codes are identified by their position in pn_codes[],
+  0 means unknown
+ */
+#define PN_CODE_ID(row, col) ((row)*9 + (col) + 1)
+
 /* The PN codes */
 static const uint8_t pn_codes[5][9][8] = {
 { /* Row 0 */
@@ -363,24 +430,31 @@ static const struct reg_config cyrf_transfer_config[] = {
 
 static struct {
     uint8_t channels[23];
+    uint8_t pn_rows[23];
     uint8_t mfg_id[4];
     uint8_t current_channel;
     uint8_t current_rf_channel;
     uint16_t crc_seed;
     uint8_t sop_col;
     uint8_t data_col;
-    uint8_t last_sop_code[8];
-    uint8_t last_data_code[16];
+    uint8_t sop_code_id;
+    uint8_t data_code_id;
     
     uint16_t num_channels;
     uint16_t pwm_channels[MAX_CHANNELS];
     uint32_t bind_send_end_ms;
     bool invert_seed;
+    bool send_record;
+    uint8_t extra_count;
     uint8_t zero_counter;
     bool receive_telem;
     uint32_t telem_recv_count;
-    uint16_t sends_since_recv;
-    uint16_t sends_since_power_change;
+    uint32_t telem_slots;
+    uint8_t telem_slots_ok;
+    bool telem_slot_ok;
+    uint8_t link_rssi;
+    uint8_t power_target_rssi;
+    uint16_t slots_since_power_change;
     uint32_t send_count;
     uint16_t rssi_sum;
     uint16_t rssi_count;
@@ -400,22 +474,83 @@ static struct {
     uint8_t current_send_pps;
     uint8_t tx_max_power;
     uint8_t autobind_count;
+    bool retuned;
+    uint8_t retune_channel;
+    uint32_t send_start_us;
+    bool noise_sampling;
 } dsm;
 
+/*
+  background noise floor. When the radio retunes in a gap in the
+  frame it is left in receive mode on the next channel long enough to
+  take a burst of RSSI samples. The peak of each burst goes into a per
+  channel EWMA, scaled by 2^NOISE_EWMA_SHIFT
+ */
+#define NOISE_SETTLE_US 300
+#define NOISE_SAMPLES 8
+#define NOISE_EWMA_SHIFT 3
+
+static uint8_t noise_floor[DSM_MAX_CHANNEL+1];
+
+/*
+  register writes for the packet send path. These are sent from the
+  SPI interrupt so the timer callback does not wait on the SPI bus
+ */
+#define MAX_QUEUED_WRITES 16
+static struct spi_write write_queue[MAX_QUEUED_WRITES];
+static uint8_t write_queue_len;
+// writes dropped with the queue full, reported on the status line
+static volatile uint16_t write_queue_overflow;
+static uint8_t tx_buffer[16];
+
+// time of the first packet since startup, ms
+static uint32_t first_send_ms;
+
 static void radio_init(void);
+static void queue_transmit16(const uint8_t data[16]);
 static void cypress_transmit16(const uint8_t data[16]);
-static void dsm_set_channel(uint8_t channel, bool is_dsm2, uint8_t sop_col, uint8_t data_col, uint16_t crc_seed);
+static void dsm_set_channel(uint8_t channel, uint8_t pn_row, uint8_t sop_col, uint8_t data_col, uint16_t crc_seed);
 static void send_normal_packet(void);
+static void build_next_packet(void);
 static void send_bind_packet(void);
+static void start_retune(bool sample_noise);
+static void telem_window_end(void);
+static void fw_progress_load(void);
+
 
+static uint8_t read_register(uint8_t reg);
+static void write_register(uint8_t reg, uint8_t value);
+
+/*
+  with FAST_BOOT the radio is ready once a register write reads back,
+  which is polled for rather than waiting a fixed time
+ */
+#define RADIO_RESET_US 100
+#define RADIO_READY_TIMEOUT_MS 1000
 
 static void cypress_reset(void)
 {
+#if FAST_BOOT
+    uint16_t ms;
+
+    gpio_set(RADIO_RST);
+    delay_us(RADIO_RESET_US);
+    gpio_clear(RADIO_RST);
+    for (ms=0; ms<RADIO_READY_TIMEOUT_MS; ms++) {
+        write_register(CYRF_CHANNEL, 23);
+        if (read_register(CYRF_CHANNEL) == 23) {
+            break;
+        }
+        delay_ms(1);
+    }
+    printf("Cypress: ready after %u ms\n", ms);
+#else
     // hold reset high for 500ms
     gpio_set(RADIO_RST);
     delay_ms(500);
     gpio_clear(RADIO_RST);
     delay_ms(500);
+#endif
 }
 
 void cypress_init(void)
@@ -438,14 +573,24 @@ void cypress_init(void)
     // setup interrupt
     gpio_config(RADIO_INT, GPIO_INPUT_FLOAT_IRQ);
 
-    tx_max = eeprom_read(EEPROM_TXMAX);
+    tx_max = settings_get(EEPROM_TXMAX);
     // don't use power levels below 4
     if (tx_max > 3 && tx_max < 9) {
         dsm.tx_max_power = tx_max-1;
     } else {
         dsm.tx_max_power = 3;
     }
+
+    dsm.power_target_rssi = settings_get(EEPROM_POWER_TARGET);
+    if (dsm.power_target_rssi <= POWER_HYSTERESIS || dsm.power_target_rssi > 31-POWER_HYSTERESIS) {
+        dsm.power_target_rssi = POWER_TARGET_RSSI;
+    }
+    // start assuming a good link
+    dsm.telem_slots = 0xFFFFFFFFUL;
+    dsm.telem_slots_ok = POWER_WINDOW;
     
+    fw_progress_load();
+
     cypress_reset();
 
     radio_init();
@@ -470,6 +615,63 @@ static void write_register(uint8_t reg, uint8_t value)
     spi_write(2, d);
 }
 
+/*
+  called from the SPI interrupt when a queue of writes has been sent
+ */
+static void write_queue_complete(void)
+{
+    write_queue_len = 0;
+}
+
+/*
+  add a register write to the write queue
+ */
+static void queue_write(uint8_t reg, uint8_t n, const uint8_t *data, uint8_t value)
+{
+    struct spi_write *w;
+
+    // the queue belongs to the SPI driver until it completes
+    spi_queue_wait();
+
+    if (write_queue_len == MAX_QUEUED_WRITES) {
+        // no printf, this runs in the radio interrupts
+        write_queue_overflow++;
+        return;
+    }
+    w = &write_queue[write_queue_len++];
+    w->reg = reg | FLAG_WRITE;
+    w->len = n;
+    w->value = value;
+    w->data = data;
+}
+
+/*
+  queue a multi-byte register write. The data must stay valid until
+  the queue has been sent
+ */
+static void queue_multiple(uint8_t reg, uint8_t n, const uint8_t *data)
+{
+    queue_write(reg, n, data, 0);
+}
+
+/*
+  queue a one byte register write
+ */
+static void queue_register(uint8_t reg, uint8_t value)
+{
+    queue_write(reg, 1, NULL, value);
+}
+
+/*
+  start sending the write queue, if it is not already in flight
+ */
+static void queue_start(void)
+{
+    if (!spi_queue_busy()) {
+        spi_queue_start(write_queue, write_queue_len, write_queue_complete);
+    }
+}
+
 /*
   read radio status, handling the race condition between completion and error
  */
@@ -511,6 +713,88 @@ static void force_initial_state(void)
     }
 }
 
+/*
+  number of hops in the current protocol
+ */
+static uint8_t dsm_channel_count(void)
+{
+    return is_DSM2()?2:23;
+}
+
+/*
+  take a burst of RSSI samples on the retuned channel, then put the
+  radio back in synth TX ready for the send
+ */
+static void noise_sample(void)
+{
+    uint8_t buf[NOISE_SAMPLES];
+    uint8_t highest = 0;
+    uint8_t i;
+    uint8_t *nf;
+
+    if (!dsm.noise_sampling) {
+        return;
+    }
+    // without FLAG_AUTO_INC each byte read is a new RSSI sample
+    spi_read_registers(CYRF_RSSI, buf, NOISE_SAMPLES);
+    write_register(CYRF_XACT_CFG, CYRF_MODE_SYNTH_TX | CYRF_FRC_END);
+    dsm.noise_sampling = false;
+
+    for (i=0; i<NOISE_SAMPLES; i++) {
+        uint8_t r = buf[i] & 0x1F;
+        if (r > highest) {
+            highest = r;
+        }
+    }
+    nf = &noise_floor[dsm.retune_channel];
+    *nf = *nf - (*nf >> NOISE_EWMA_SHIFT) + highest;
+}
+
+/*
+  start changing to the channel of the next hop once the radio is
+  idle after a send or telemetry receive. This gives the synthesiser
+  time to settle before the next packet is due, so the send does not
+  need to wait for it. If there is time the noise floor of the channel
+  is also sampled
+ */
+static void start_retune(bool sample_noise)
+{
+    if (dsm.FCC_test_mode) {
+        return;
+    }
+    dsm.retune_channel = dsm.channels[(dsm.current_channel + 1) % dsm_channel_count()];
+    if (sample_noise) {
+        write_register(CYRF_XACT_CFG, CYRF_MODE_RX | CYRF_FRC_END);
+    } else {
+        write_register(CYRF_XACT_CFG, CYRF_MODE_SYNTH_TX | CYRF_FRC_END);
+    }
+    write_register(CYRF_RX_ABORT, 0);
+    write_register(CYRF_CHANNEL, dsm.retune_channel);
+    dsm.retuned = true;
+    if (sample_noise) {
+        dsm.noise_sampling = true;
+        timer_call_after_us(TIMER_SLOT_NOISE, NOISE_SETTLE_US, noise_sample);
+    }
+}
+
+/*
+  noise floor RSSI of a channel in the hop sequence
+ */
+uint8_t get_noise_floor(uint8_t hop)
+{
+    uint8_t nf = noise_floor[dsm.channels[hop % dsm_channel_count()]];
+    return (nf + (1U<<(NOISE_EWMA_SHIFT-1))) >> NOISE_EWMA_SHIFT;
+}
+
+/*
+  noise floor RSSI of the channel the packet being built will be sent
+  on, for channel 8 key 7
+ */
+uint8_t get_next_noise_floor(void)
+{
+    return get_noise_floor(dsm.current_channel + 1);
+}
+
 /*
   set desired channel
  */
@@ -532,6 +816,32 @@ static void radio_set_config(const struct reg_config *conf, uint8_t size)
     }
 }
 
+/*
+  row of pn_codes[] used on a channel
+ */
+static uint8_t dsm_pn_row(uint8_t channel, bool is_dsm2)
+{
+    return is_dsm2? channel % 5 : (channel-2) % 5;
+}
+
+/*
+  build the hop plan once the channels are known. The PN row of each
+  hop is precomputed so setting up a hop takes the same short time
+  for all 23 DSMX hops as for the 2 DSM2 channels. The seed polarity
+  alternates with each packet rather than with the hop, as the DSMX
+  sequence has an odd number of hops
+ */
+static void dsm_plan_hops(void)
+{
+    uint8_t i;
+    for (i=0; i<dsm_channel_count(); i++) {
+        dsm.pn_rows[i] = dsm_pn_row(dsm.channels[i], is_DSM2());
+    }
+    // the first hop writes both codes
+    dsm.sop_code_id = 0;
+    dsm.data_code_id = 0;
+}
+
 #if SUPPORT_DSMX
 /*
   Generate the DSMX channels from the manufacturer ID
@@ -600,10 +910,49 @@ static void dsm_setup_transfer_dsmx(void)
     dsm.data_col = 7 - dsm.sop_col;
 
     dsm_generate_channels_dsmx(dsm.mfg_id, dsm.channels);
+    dsm_plan_hops();
     printf("Setup for DSMX send\n");
 }
 #endif // SUPPORT_DSMX
 
+/*
+  return the highest RSSI seen on the current channel, stopping early
+  once it is clearly noisy
+ */
+static uint8_t scan_rssi(void)
+{
+    uint8_t buf[DSM_SCAN_BURST];
+    uint8_t highest = 0;
+    uint8_t reg = CYRF_RSSI;
+    uint16_t samples;
+
+    // without FLAG_AUTO_INC each byte read is a new RSSI sample
+    spi_force_chip_select(true);
+    spi_write(1, &reg);
+    for (samples=0; samples<DSM_SCAN_SAMPLES && highest < DSM_SCAN_NOISY_RSSI; samples += DSM_SCAN_BURST) {
+        uint8_t j;
+        spi_transfer(DSM_SCAN_BURST, NULL, buf);
+        for (j=0; j<DSM_SCAN_BURST; j++) {
+            uint8_t r = buf[j] & 0x1F;
+            if (r > highest) {
+                highest = r;
+            }
+        }
+    }
+    spi_force_chip_select(false);
+    return highest;
+}
+
+/*
+  put the radio in receive for RSSI sampling
+ */
+static void scan_start(void)
+{
+    write_register(CYRF_XACT_CFG, CYRF_MODE_RX | CYRF_FRC_END);
+    write_register(CYRF_RX_ABORT, 0);
+    delay_ms(1);
+}
+
 /*
   scan for best channels
  */
@@ -613,7 +962,8 @@ static void scan_channels(void)
     uint8_t best = 0;
     uint8_t best_rssi = 32;
     static uint8_t rssi[DSM_MAX_CHANNEL/2];
-    uint8_t wifi_chan = eeprom_read(EEPROM_WIFICHAN_OFFSET);
+    uint32_t start_us = micros();
+    uint8_t wifi_chan = settings_get(EEPROM_WIFICHAN_OFFSET);
     uint8_t avoid_chan = ((wifi_chan-1) * 5) + 10;
     uint8_t avoid_chan_low=0, avoid_chan_high=0;
 
@@ -629,14 +979,14 @@ static void scan_channels(void)
         avoid_chan_high = avoid_chan + 11;
     }
     
-    write_register(CYRF_XACT_CFG, CYRF_MODE_RX | CYRF_FRC_END);
-    write_register(CYRF_RX_ABORT, 0);
-    delay_ms(1);
+    scan_start();
+
+    // unscanned channels are never chosen
+    memset(rssi, 0xff, sizeof(rssi));
 
     // find the first channel
     i = 0;
     while (true) {
-        uint16_t samples = 1500;
         uint8_t highest = 0;
 
         if (i < DSM_SCAN_MIN_CH || i > DSM_SCAN_MAX_CH) {
@@ -660,27 +1010,36 @@ static void scan_channels(void)
         }
         
         set_channel(i);
-        while (samples--) {
-            uint8_t r = read_register(CYRF_RSSI) & 0x1F;
-            if (r > highest) {
-                highest = r;
-            }
-        }
+        highest = scan_rssi();
         
         printf("%u:%u ", i, highest);
         rssi[i/2] = highest;
+        noise_floor[i] = highest << NOISE_EWMA_SHIFT;
         if (highest < best_rssi) {
             best = i;
             best_rssi = highest;
         }
 
+        if (highest <= DSM_SCAN_CLEAN_RSSI) {
+            // stop if there is a clean second channel for the best one
+            uint8_t j;
+            for (j=DSM_SCAN_MIN_CH; j<=i; j+=2) {
+                if (rssi[j/2] <= DSM_SCAN_CLEAN_RSSI && (j>best+10 || j<best-10)) {
+                    break;
+                }
+            }
+            if (j <= i) {
+                break;
+            }
+        }
+
         i += 2;
         if (i > DSM_SCAN_MAX_CH) {
             break;
         }
     }
     
-    printf("\n");
+    printf("\nScan took %u ms\n", (uint16_t)((micros() - start_us) / 1000));
 
     dsm.channels[0] = best;
 
@@ -701,6 +1060,87 @@ static void scan_channels(void)
     printf("Chose channels %u and %u\n", dsm.channels[0], dsm.channels[1]);
 }
 
+/*
+  the channel pair of the last full scan is cached in EEPROM with the
+  RSSI seen on each channel and the WiFi channel it avoided. At boot
+  only those two channels are sampled, and the pair is reused if
+  neither has become noisier than CHAN_CACHE_MARGIN above its cached
+  RSSI. The last byte is the inverted CRC8 of the rest, written last
+ */
+#define CHAN_CACHE_LEN 6
+#define CHAN_CACHE_MARGIN 1
+
+#if FAST_BOOT
+static uint8_t chan_cache_check(const uint8_t *rec)
+{
+    return ~crc_crc8(rec, CHAN_CACHE_LEN-1);
+}
+#endif
+
+/*
+  check the cached channel pair, returning true if it was loaded into
+  dsm.channels
+ */
+static bool chan_cache_use(void)
+{
+#if FAST_BOOT
+    uint8_t rec[CHAN_CACHE_LEN];
+    uint8_t i;
+
+    for (i=0; i<CHAN_CACHE_LEN; i++) {
+        rec[i] = eeprom_read(EEPROM_CHAN_CACHE_OFFSET+i);
+    }
+    if (rec[CHAN_CACHE_LEN-1] != chan_cache_check(rec) ||
+        rec[4] != settings_get(EEPROM_WIFICHAN_OFFSET) ||
+        rec[0] > DSM_MAX_CHANNEL || rec[1] > DSM_MAX_CHANNEL) {
+        return false;
+    }
+
+    scan_start();
+    printf("Check cached: ");
+    for (i=0; i<2; i++) {
+        uint8_t highest;
+        set_channel(rec[i]);
+        highest = scan_rssi();
+        printf("%u:%u ", rec[i], highest);
+        if (highest >= DSM_SCAN_NOISY_RSSI || highest > rec[2+i] + CHAN_CACHE_MARGIN) {
+            printf("noisy\n");
+            return false;
+        }
+        noise_floor[rec[i]] = highest << NOISE_EWMA_SHIFT;
+    }
+    dsm.channels[0] = rec[0];
+    dsm.channels[1] = rec[1];
+    printf("\nUsing cached channels %u and %u\n", dsm.channels[0], dsm.channels[1]);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+  cache the channel pair of a full scan
+ */
+static void chan_cache_save(void)
+{
+#if FAST_BOOT
+    uint8_t rec[CHAN_CACHE_LEN];
+    uint8_t i;
+
+    rec[0] = dsm.channels[0];
+    rec[1] = dsm.channels[1];
+    rec[2] = noise_floor[dsm.channels[0]] >> NOISE_EWMA_SHIFT;
+    rec[3] = noise_floor[dsm.channels[1]] >> NOISE_EWMA_SHIFT;
+    rec[4] = settings_get(EEPROM_WIFICHAN_OFFSET);
+    rec[CHAN_CACHE_LEN-1] = chan_cache_check(rec);
+    // invalidate first, so a save cut short can't pass the check
+    eeprom_write(EEPROM_CHAN_CACHE_OFFSET+CHAN_CACHE_LEN-1, ~rec[CHAN_CACHE_LEN-1]);
+    for (i=0; i<CHAN_CACHE_LEN; i++) {
+        eeprom_write(EEPROM_CHAN_CACHE_OFFSET+i, rec[i]);
+    }
+#endif
+}
+
 /*
   setup for DSM2 transfers
  */
@@ -712,13 +1152,15 @@ static void dsm_setup_transfer_dsm2(void)
     dsm.sop_col = (dsm.mfg_id[0] + dsm.mfg_id[1] + dsm.mfg_id[2] + 2) & 0x07;
     dsm.data_col = 7 - dsm.sop_col;
 
-    if (dsm.factory_test_mode == 0) {
-        // scan for best channels
-        scan_channels();
-    } else {
+    if (dsm.factory_test_mode != 0) {
         dsm.channels[0] = (dsm.factory_test_mode*7) % DSM_MAX_CHANNEL;
         dsm.channels[1] = (dsm.channels[0] + 5) % DSM_MAX_CHANNEL;
+    } else if (!chan_cache_use()) {
+        // scan for best channels
+        scan_channels();
+        chan_cache_save();
     }
+    dsm_plan_hops();
 
     printf("Setup for DSM2 send\n");
 }
@@ -798,39 +1240,241 @@ static void start_telem_receive(void)
     write_register(CYRF_RX_CTRL, CYRF_RX_GO | CYRF_RXC_IRQEN | CYRF_RXE_IRQEN);
 }
 
+/*
+  OTA firmware data arrives a few bytes at a time. It is collected in
+  a block aligned staging buffer which is programmed as one flash
+  block when the write reaches the end of the block, moves to another
+  block, or goes idle.
+
+  With TELEM_FW_WINDOW the chunks of a block may arrive in any order,
+  so the block is programmed once all of its chunks have been
+  received, and the bitmap of received chunks is reported back in
+  TXTELEM_FW_WINDOW uplink records
+ */
+#define FW_STAGE_IDLE_MS 500
+#define FW_CHUNK_SIZE 8
+#define FW_WINDOW_TIMEOUT_MS 1000
+
+static uint8_t fw_stage[FLASH_BLOCK_SIZE];
+static uint16_t fw_stage_offset;
+static bool fw_stage_dirty;
+static uint32_t fw_stage_ms;
+static uint16_t fw_stage_bitmap;
+static bool fw_window_active;
+
+/*
+  progress of the image in the new firmware slot, so an interrupted
+  update can resume. This is a RAM copy of the image size/CRC header
+  and a bitmap of completed blocks, kept in EEPROM by
+  cypress_flush_firmware()
+ */
+#define FW_SLOT_BLOCKS (16*1024/FLASH_BLOCK_SIZE)
+#define FW_PROGRESS_HEADER_LEN 6
+
+static struct {
+    uint8_t header[FW_PROGRESS_HEADER_LEN];
+    uint8_t done[FW_SLOT_BLOCKS/8];
+} fw_progress;
+static bool fw_progress_dirty;
+
+static void fw_progress_load(void)
+{
+    uint8_t i;
+    uint8_t *p = (uint8_t *)&fw_progress;
+    for (i=0; i<sizeof(fw_progress); i++) {
+        p[i] = eeprom_read(EEPROM_OTA_PROGRESS_OFFSET+i);
+    }
+}
+
+/*
+  write changed progress bytes to EEPROM. The bitmap goes first so a
+  power loss can't leave an old bitmap tied to a new header
+ */
+static void fw_progress_save(void)
+{
+    uint8_t i;
+    uint8_t *p = (uint8_t *)&fw_progress.done[0];
+    for (i=0; i<sizeof(fw_progress.done); i++) {
+        eeprom_write(EEPROM_OTA_PROGRESS_OFFSET+FW_PROGRESS_HEADER_LEN+i, p[i]);
+    }
+    for (i=0; i<FW_PROGRESS_HEADER_LEN; i++) {
+        eeprom_write(EEPROM_OTA_PROGRESS_OFFSET+i, fw_progress.header[i]);
+    }
+}
+
+/*
+  a new image header resets the progress, unless it matches the image
+  being resumed
+ */
+static void fw_progress_header(const uint8_t *header)
+{
+    if (memcmp(header, fw_progress.header, FW_PROGRESS_HEADER_LEN) != 0) {
+        memcpy(fw_progress.header, header, FW_PROGRESS_HEADER_LEN);
+        memset(fw_progress.done, 0, sizeof(fw_progress.done));
+        fw_progress_dirty = true;
+    }
+}
+
+/*
+  first block of the slot not yet written, FW_SLOT_BLOCKS-1 if all are
+ */
+static uint8_t fw_progress_first_missing(void)
+{
+    uint8_t b;
+    for (b=0; b<FW_SLOT_BLOCKS-1; b++) {
+        if ((fw_progress.done[b>>3] & (1U<<(b&7))) == 0) {
+            break;
+        }
+    }
+    return b;
+}
+
+static void fw_stage_flush(void)
+{
+    if (fw_stage_dirty) {
+        const uint8_t *dest = (const uint8_t *)(NEW_FIRMWARE_BASE + fw_stage_offset);
+        uint8_t block = fw_stage_offset / FLASH_BLOCK_SIZE;
+        // resent blocks are often unchanged
+        if (memcmp(dest, fw_stage, FLASH_BLOCK_SIZE) != 0) {
+            flash_write_block(NEW_FIRMWARE_BASE + fw_stage_offset, fw_stage);
+        }
+        fw_stage_dirty = false;
+        if (fw_stage_bitmap == 0xFFFF) {
+            fw_progress.done[block>>3] |= 1U<<(block&7);
+            fw_progress_dirty = true;
+        }
+    }
+}
+
 /*
   write to new firmware location
  */
-static void write_flash_copy(uint16_t offset, const uint8_t *data, uint8_t len)
+static void write_flash_copy(uint16_t offset, const uint8_t *data, uint8_t len, bool windowed)
 {
-    uint16_t dest = NEW_FIRMWARE_BASE + offset;
-    uint8_t *ptr1;
-    ptr1 = (uint8_t *)dest;
+    if (offset == 0 && len >= FW_PROGRESS_HEADER_LEN) {
+        fw_progress_header(data);
+    }
+    if (windowed) {
+        uint8_t block = offset / FLASH_BLOCK_SIZE;
+        // the reported bitmap lags, so drop late and repeated chunks
+        // rather than flushing the block in progress half received
+        if (fw_progress.done[block>>3] & (1U<<(block&7))) {
+            return;
+        }
+        if (fw_stage_dirty && fw_stage_bitmap != 0xFFFF &&
+            (offset & ~(FLASH_BLOCK_SIZE-1)) != fw_stage_offset &&
+            timer_get_ms() - fw_stage_ms <= FW_WINDOW_TIMEOUT_MS) {
+            return;
+        }
+    }
+    while (len > 0) {
+        uint16_t block_offset = offset & ~(FLASH_BLOCK_SIZE-1);
+        uint8_t ofs = offset & (FLASH_BLOCK_SIZE-1);
+        uint8_t n = FLASH_BLOCK_SIZE - ofs;
+        if (n > len) {
+            n = len;
+        }
+        if (!fw_stage_dirty || block_offset != fw_stage_offset) {
+            fw_stage_flush();
+            // start from the current contents so partial blocks are kept
+            memcpy(fw_stage, (const uint8_t *)(NEW_FIRMWARE_BASE + block_offset), FLASH_BLOCK_SIZE);
+            // the window status is read from the radio timer interrupt
+            __critical {
+                fw_stage_offset = block_offset;
+                fw_stage_bitmap = 0;
+            }
+        }
+        memcpy(&fw_stage[ofs], data, n);
+        fw_stage_dirty = true;
+        __critical {
+            fw_stage_bitmap |= 1U << (ofs / FW_CHUNK_SIZE);
+        }
+        if (windowed ? (fw_stage_bitmap == 0xFFFF) : (ofs + n == FLASH_BLOCK_SIZE)) {
+            fw_stage_flush();
+        }
+        offset += n;
+        data += n;
+        len -= n;
+    }
+    __critical {
+        fw_stage_ms = timer_get_ms();
+    }
+}
 
-    progmem_unlock();
+/*
+  program a partly written firmware block once the OTA stream goes
+  idle, and save the update progress. Called from the main loop
+ */
+void cypress_flush_firmware(void)
+{
+    if (fw_stage_dirty && timer_get_ms() - fw_stage_ms > FW_STAGE_IDLE_MS) {
+        fw_stage_flush();
+    }
+    if (fw_progress_dirty) {
+        fw_progress_dirty = false;
+        fw_progress_save();
+    }
+}
 
-    FLASH_CR1 = 0;
-    FLASH_CR2 = 0x40;
-    FLASH_NCR2 = (uint8_t)(~0x40);
-    memcpy(&ptr1[0], &data[0], 4);
+/*
+  first block of the new firmware slot that an interrupted update
+  still needs, for channel 8 key 7
+ */
+uint8_t get_fw_resume_block(void)
+{
+    return fw_progress_first_missing();
+}
 
-    if (len > 4) {
-        FLASH_CR2 = 0x40;
-        FLASH_NCR2 = (uint8_t)~0x40;
-        memcpy(&ptr1[4], &data[4], 4);
+/*
+  block number and chunk bitmap of the windowed transfer, for uplink
+  records. Returns false when no windowed transfer is active
+ */
+bool get_fw_window_bitmap(uint8_t *block, uint16_t *bitmap)
+{
+    if (!fw_window_active || timer_get_ms() - fw_stage_ms > FW_WINDOW_TIMEOUT_MS) {
+        return false;
     }
-    
-    progmem_lock();
+    *block = fw_stage_offset / FLASH_BLOCK_SIZE;
+    *bitmap = fw_stage_bitmap;
+    return true;
 }
 
+/*
+  received telemetry packets are queued by the radio IRQ and processed
+  from the main loop, as processing may print, copy tune data or
+  program flash. The IRQ handler is the only producer and
+  cypress_process_telem() the only consumer, so the head and tail
+  indexes each have a single writer and no locking is needed
+ */
+#define TELEM_QUEUE_LEN 4 // must be a power of 2
+
+static struct telem_queue_entry {
+    struct telem_packet pkt;
+    uint8_t rssi;
+} telem_queue[TELEM_QUEUE_LEN];
+static volatile uint8_t telem_queue_head;
+static volatile uint8_t telem_queue_tail;
+static volatile uint16_t telem_queue_overflow;
+
 static uint8_t last_mode;
 
+/*
+  offset of a firmware or tune packet, which is little endian on the
+  wire
+ */
+static uint16_t fw_offset(const struct telem_packet *pkt)
+{
+    return pkt->payload.pkt[2] | (((uint16_t)pkt->payload.pkt[3])<<8);
+}
+
 static void process_telem_packet(const struct telem_packet *pkt)
 {
     switch (pkt->type) {
     case TELEM_STATUS:
-        memcpy(&t_status, &pkt->payload.status, sizeof(t_status));
-        dsm.sends_since_recv = 0;
+        // the packet builder reads the flags from the radio interrupts
+        __critical {
+            memcpy(&t_status, &pkt->payload.status, sizeof(t_status));
+        }
         if (t_status.tx_max > 3 && t_status.tx_max < 9) {
             // adjust power level on the fly
             dsm.tx_max_power = t_status.tx_max-1;
@@ -850,11 +1494,11 @@ static void process_telem_packet(const struct telem_packet *pkt)
     case TELEM_PLAY: {
         struct telem_firmware fw;
         memcpy(&fw, &pkt->payload.fw, sizeof(fw));
+        fw.offset = fw_offset(pkt);
         printf("FW type=%u ofs=%u len=%u\n", pkt->type, fw.offset, fw.len);
-        fw.offset = ((fw.offset & 0xFF)<<8) | (fw.offset>>8);
         if (pkt->type == TELEM_FW) {
             if (fw.offset < 16*1024 && fw.len <= 8) {
-                write_flash_copy(fw.offset, &fw.data[0], fw.len);
+                write_flash_copy(fw.offset, &fw.data[0], fw.len, false);
             }
         } else {
             buzzer_tune_add(fw.offset, &fw.data[0], fw.len);
@@ -862,7 +1506,59 @@ static void process_telem_packet(const struct telem_packet *pkt)
         telem_ack_value = fw.seq;
         break;
     }
+    case TELEM_FW_WINDOW: {
+        struct telem_firmware fw;
+        memcpy(&fw, &pkt->payload.fw, sizeof(fw));
+        fw.offset = fw_offset(pkt);
+        // only whole chunks, the sender pads the last block
+        if (fw.offset < 16*1024 && fw.len == FW_CHUNK_SIZE &&
+            (fw.offset % FW_CHUNK_SIZE) == 0) {
+            write_flash_copy(fw.offset, &fw.data[0], fw.len, true);
+            fw_window_active = true;
+        }
+        break;
+    }
+    }
+}
+
+/*
+  process queued telemetry packets. Called from the main loop
+ */
+void cypress_process_telem(void)
+{
+    while (telem_queue_tail != telem_queue_head) {
+        const struct telem_queue_entry *e = &telem_queue[telem_queue_tail & (TELEM_QUEUE_LEN-1)];
+        dsm.rssi_sum += e->rssi;
+        dsm.rssi_count++;
+        process_telem_packet(&e->pkt);
+        // hand the entry back to the IRQ handler
+        telem_queue_tail++;
+    }
+}
+
+/*
+  number of telemetry packets dropped because the queue was full
+ */
+uint16_t get_telem_overflow(void)
+{
+    uint16_t ret;
+    __critical {
+        ret = telem_queue_overflow;
     }
+    return ret;
+}
+
+/*
+  number of radio register writes dropped because the write queue was
+  full
+ */
+uint16_t get_write_queue_overflow(void)
+{
+    uint16_t ret;
+    __critical {
+        ret = write_queue_overflow;
+    }
+    return ret;
 }
 
 /*
@@ -873,6 +1569,7 @@ static void irq_handler_recv(uint8_t rx_status)
     struct telem_packet pkt;
     uint8_t rlen;
     uint8_t crc;
+    uint32_t elapsed;
     
     if ((rx_status & (CYRF_RXC_IRQ | CYRF_RXE_IRQ)) == 0) {
         // nothing interesting yet
@@ -883,19 +1580,78 @@ static void irq_handler_recv(uint8_t rx_status)
     if (rlen != 16) {
         printf("rlen=%u\n", rlen);
         spi_read_registers(CYRF_RX_BUFFER, (uint8_t *)&pkt, 16);
+    } else {
+        spi_read_registers(CYRF_RX_BUFFER, (uint8_t *)&pkt, rlen);
+        crc = crc_crc8((uint8_t*)&pkt.type, 15);
+        if (crc == pkt.crc) {
+            uint8_t rssi = read_register(CYRF_RSSI) & 0x1F;
+            uint8_t head = telem_queue_head;
+            dsm.link_rssi = dsm.link_rssi - (dsm.link_rssi >> POWER_RSSI_SHIFT) + rssi;
+            dsm.telem_slot_ok = true;
+            if ((uint8_t)(head - telem_queue_tail) == TELEM_QUEUE_LEN) {
+                telem_queue_overflow++;
+            } else {
+                struct telem_queue_entry *e = &telem_queue[head & (TELEM_QUEUE_LEN-1)];
+                memcpy(&e->pkt, &pkt, sizeof(pkt));
+                e->rssi = rssi;
+                // publish the entry only once it is complete
+                telem_queue_head = head + 1;
+            }
+        }
+    }
+
+    /*
+      the receive window is over, so we can start retuning for the
+      next send as long as there is time for the synthesiser to settle
+      before the send is due
+     */
+    elapsed = micros() - dsm.send_start_us;
+    if (elapsed < frame_profiles[frame_profile].long_us - 2000) {
+        start_retune(true);
+    } else if (elapsed < frame_profiles[frame_profile].long_us - 1000) {
+        start_retune(false);
+    }
+}
+
+#if PERF_STATS
+/*
+  count a telemetry packet that was arriving when its receive window
+  ended. This runs from the noise timer slot, not the send callback
+  whose jitter is measured. Reading the status clears it, so a packet
+  that completed in the meantime is handed to the receive handler
+ */
+static void perf_clip_check(void)
+{
+    uint8_t rx_status;
+
+    if (state != STATE_RECV_TELEM || dsm.retuned) {
         return;
     }
-    spi_read_registers(CYRF_RX_BUFFER, (uint8_t *)&pkt, rlen);
-    crc = crc_crc8((uint8_t*)&pkt.type, 15);
-    if (crc == pkt.crc) {
-        dsm.rssi_sum += read_register(CYRF_RSSI) & 0x1F;
-        dsm.rssi_count++;
-        process_telem_packet(&pkt);
+    rx_status = read_status_debounced(CYRF_RX_IRQ_STATUS);
+    if (rx_status & (CYRF_RXC_IRQ | CYRF_RXE_IRQ)) {
+        irq_handler_recv(rx_status);
+    } else if (rx_status & CYRF_SOPDET_IRQ) {
+        perf_count_clip();
     }
 }
+#endif
 
 /*
-  handle a receive IRQ
+  end of a telemetry receive slot that is shorter than the frame gap
+  with no packet received. Called from the noise timer slot
+ */
+static void telem_window_end(void)
+{
+    if (state == STATE_RECV_TELEM && !dsm.retuned) {
+#if PERF_STATS
+        perf_clip_check();
+#endif
+        start_retune(true);
+    }
+}
+
+/*
+  handle a send IRQ
  */
 static void irq_handler_send(uint8_t tx_status)
 {
@@ -903,6 +1659,13 @@ static void irq_handler_send(uint8_t tx_status)
         if (state == STATE_RECV_WAIT) {
             state = STATE_RECV_TELEM;
             start_telem_receive();
+        } else if (state == STATE_SEND || state == STATE_AUTOBIND_SEND) {
+            start_retune(true);
+        } else {
+            return;
+        }
+        if (!dsm.FCC_test_mode) {
+            build_next_packet();
         }
     }
 }
@@ -937,31 +1700,38 @@ void cypress_irq(void)
 }
 
 /*
- Set the current DSM channel with SOP, CRC and data code
+ Set the current DSM channel with SOP, CRC and data code. The CRC
+ seed and codes are queued, to be sent with the next packet. The
+ codes last written are remembered by their pn_codes[] position, so
+ they are only rewritten when the hop needs different ones
  */
-static void dsm_set_channel(uint8_t channel, bool is_dsm2, uint8_t sop_col, uint8_t data_col, uint16_t crc_seed)
+static void dsm_set_channel(uint8_t channel, uint8_t pn_row, uint8_t sop_col, uint8_t data_col, uint16_t crc_seed)
 {
-    uint8_t pn_row = is_dsm2? channel % 5 : (channel-2) % 5;
+    uint8_t sop_code_id = PN_CODE_ID(pn_row, sop_col);
+    uint8_t data_code_id = PN_CODE_ID(pn_row, data_col);
 
     //printf("c=%u s=0x%x\n", channel, crc_seed);
     
-    // Change channel
-    set_channel(channel);
+    // Change channel, unless we already retuned for it after the last send
+    if (!dsm.retuned || dsm.retune_channel != channel) {
+        set_channel(channel);
+    }
+    dsm.retuned = false;
 
     // set CRC seed
-    write_register(CYRF_CRC_SEED_LSB, crc_seed & 0xff);
-    write_register(CYRF_CRC_SEED_MSB, crc_seed >> 8);
+    queue_register(CYRF_CRC_SEED_LSB, crc_seed & 0xff);
+    queue_register(CYRF_CRC_SEED_MSB, crc_seed >> 8);
 
     // set start of packet code
-    if (memcmp(dsm.last_sop_code, pn_codes[pn_row][sop_col], 8) != 0) {
-        write_multiple(CYRF_SOP_CODE, 8, pn_codes[pn_row][sop_col]);
-        memcpy(dsm.last_sop_code, pn_codes[pn_row][sop_col], 8);
+    if (dsm.sop_code_id != sop_code_id) {
+        queue_multiple(CYRF_SOP_CODE, 8, pn_codes[pn_row][sop_col]);
+        dsm.sop_code_id = sop_code_id;
     }
 
     // set data code
-    if (memcmp(dsm.last_data_code, pn_codes[pn_row][data_col], 16) != 0) {
-        write_multiple(CYRF_DATA_CODE, 16, pn_codes[pn_row][data_col]);
-        memcpy(dsm.last_data_code, pn_codes[pn_row][data_col], 16);
+    if (dsm.data_code_id != data_code_id) {
+        queue_multiple(CYRF_DATA_CODE, 16, pn_codes[pn_row][data_col]);
+        dsm.data_code_id = data_code_id;
     }
 }
 
@@ -979,11 +1749,11 @@ static void autobind_send(void)
 
     is_dsm2 = true;
     
-    dsm_set_channel(AUTOBIND_CHANNEL, true, 0, 0, 0);
+    dsm_set_channel(AUTOBIND_CHANNEL, dsm_pn_row(AUTOBIND_CHANNEL, true), 0, 0, 0);
 
     // send auto-bind at low (and fixed) power. This allows for RSSI to be used by RX
     // to detect that TX is a long way from RX, to avoid accidential auto-bind
-    write_register(CYRF_TX_CFG, CYRF_DATA_CODE_LENGTH | CYRF_DATA_MODE_8DR | CYRF_PA_M18);
+    queue_register(CYRF_TX_CFG, CYRF_DATA_CODE_LENGTH | CYRF_DATA_MODE_8DR | CYRF_PA_M18);
 
     send_bind_packet();
 }
@@ -995,26 +1765,36 @@ static const uint8_t chan_order[7] = { 1, 5, 2, 4, 6, 0, 3 };
 #endif
 
 /*
-  send a normal packet
+  normal packets are built ahead of time, from the radio IRQ once the
+  previous send has gone out, into the buffer not used by that send.
+  The send callback then only has to retune if needed and queue the
+  prepared packet, so the time from its deadline to TX_GO stays short
+  and constant. The hop is applied when the packet is sent, so retunes
+  before then still aim at current_channel+1
  */
-static void send_normal_packet(void)
-{
+static struct next_packet {
     uint8_t pkt[16];
-    uint8_t i;
-    uint8_t chan_count = is_DSM2()?2:23;
+    uint8_t hop;      // index into dsm.channels
     uint16_t seed;
+    bool short_gap;   // first packet of a frame
+    bool autobind;
+} next_packet[2];
+static uint8_t next_packet_idx;
+static bool next_packet_ready;
+
+static void build_next_packet(void)
+{
+    const struct dsm_frame_profile *profile = &frame_profiles[frame_profile];
+    struct next_packet *np = &next_packet[next_packet_idx];
+    uint8_t *pkt = np->pkt;
+    uint8_t i;
     bool send_zero = false;
-    bool send_autobind = false;
-    
-    if (state == STATE_AUTOBIND_SEND) {
-        // reset power level after autobind
-        write_register(CYRF_TX_CFG, CYRF_DATA_CODE_LENGTH | CYRF_DATA_MODE_8DR | dsm.power_level);
-    }
 
-    if (state != STATE_SEND) {
-        state = STATE_SEND;
+    if (next_packet_ready) {
+        return;
     }
-    
+    PERF_BEGIN(PERF_PKT_BUILD);
+
     /*
       when sending 7 channels with the DSMX_2 protocol we need to
       occasionally send a zero bit in the leading channel high bit in
@@ -1028,36 +1808,24 @@ static void send_normal_packet(void)
         dsm.zero_counter = 0;
     }
 
-    // we setup the new callback before we set the channel as setting
-    // the channel takes 300us for the synthesiser to settle (worst
-    // case)
-    if (dsm.invert_seed) {
-        // odd channels are sent every 3ms, even channels every 7ms, total frame time 10ms
-        timer_call_after_ms(2, send_normal_packet);    
-        dsm.receive_telem = false;
-    } else {
-        state = STATE_RECV_WAIT;
-        timer_call_after_ms(6, send_normal_packet);
-        dsm.receive_telem = true;
-    }
+    // the two packets of a frame are a short gap apart
+    np->short_gap = dsm.invert_seed;
 
     /*
       send AUTOBIND packets every 4 sends when we have never received
       a telemetry packet in DSM2 mode
      */
-    if (dsm.receive_telem == false &&
+    np->autobind = false;
+    if (np->short_gap &&
         dsm.factory_test_mode == 0 &&
         is_dsm2 &&
-        dsm.autobind_count > 4 && dsm.telem_recv_count == 0) {
+        dsm.autobind_count > profile->autobind_sends && dsm.telem_recv_count == 0) {
         dsm.autobind_count = 0;
-        send_autobind = true;
+        np->autobind = true;
     } else {
         dsm.autobind_count++;
     }
-        
-    write_register(CYRF_XACT_CFG, CYRF_MODE_SYNTH_TX | CYRF_FRC_END);
-    write_register(CYRF_RX_ABORT, 0);
-    
+
     memset(pkt, 0, 16);
 
     if (is_DSM2()) {
@@ -1070,6 +1838,19 @@ static void send_normal_packet(void)
 #endif
     }
 
+    channels_sample();
+#if UPLINK_RECORDS
+    if (dsm.invert_seed) {
+        // extra data packets carry uplink records, except one in
+        // UPLINK_EXTRA_SHARE which keeps channel 8, once the receiver
+        // has shown it decodes them
+        dsm.extra_count = (dsm.extra_count + 1) % UPLINK_EXTRA_SHARE;
+        dsm.send_record = (dsm.extra_count != 0) && (t_status.flags & TELEM_FLAG_UPLINK);
+        if (dsm.send_record) {
+            uplink_next_record();
+        }
+    }
+#endif
     for (i=0; i<7; i++) {
         int16_t v;
         uint8_t chan = i;
@@ -1078,7 +1859,10 @@ static void send_normal_packet(void)
             chan = chan_order[i];
         }
 #endif
-        if (chan == 6 && dsm.invert_seed) {
+        if (dsm.send_record && dsm.invert_seed && chan >= 4 && chan <= 6) {
+            // the record goes in place of the buttons and extra data
+            chan += UPLINK_FIRST_CHANNEL - 4;
+        } else if (chan == 6 && dsm.invert_seed) {
             // send extra data on every 2nd packet
             chan = 7;
         }
@@ -1091,39 +1875,118 @@ static void send_normal_packet(void)
     }
     
     dsm.invert_seed = !dsm.invert_seed;
-    
-    dsm.current_channel = (dsm.current_channel + 1);
-    dsm.current_channel %= chan_count;
 
-    dsm.current_rf_channel = dsm.channels[dsm.current_channel];
-    
-    seed = dsm.crc_seed;
+    np->hop = dsm.current_channel + 1;
+    if (np->hop >= dsm_channel_count()) {
+        np->hop = 0;
+    }
+
+    np->seed = dsm.crc_seed;
     if (dsm.invert_seed) {
-        seed = ~seed;
+        np->seed = ~np->seed;
+    }
+    next_packet_ready = true;
+
+    PERF_END(PERF_PKT_BUILD);
+}
+
+/*
+  send a normal packet
+ */
+static void send_normal_packet(void)
+{
+    const struct dsm_frame_profile *profile = &frame_profiles[frame_profile];
+    const struct next_packet *np;
+
+#if PERF_STATS
+    if (perf_gap_us != 0) {
+        int16_t err = (int16_t)((uint16_t)(micros() - dsm.send_start_us) - perf_gap_us);
+        perf_record(PERF_SEND_JITTER, err < 0 ? -err : err);
+    }
+#endif
+
+    // built here for the first send, or if the last did not complete
+    build_next_packet();
+    np = &next_packet[next_packet_idx];
+    next_packet_idx ^= 1;
+    next_packet_ready = false;
+
+    PERF_BEGIN(PERF_PKT_TX);
+    if (state == STATE_AUTOBIND_SEND) {
+        // reset power level after autobind
+        queue_register(CYRF_TX_CFG, CYRF_DATA_CODE_LENGTH | CYRF_DATA_MODE_8DR | dsm.power_level);
+    }
+
+    if (state != STATE_SEND) {
+        state = STATE_SEND;
+    }
+
+    if (dsm.noise_sampling) {
+        // the noise sample did not get a chance to run
+        timer_cancel(TIMER_SLOT_NOISE);
+        dsm.noise_sampling = false;
+        dsm.retuned = false;
+    }
+
+    // we setup the new callback before we set the channel as setting
+    // the channel takes 300us for the synthesiser to settle (worst
+    // case) if we were not able to retune after the last send
+    dsm.send_start_us = micros();
+    if (np->short_gap) {
+        timer_call_next_us(TIMER_SLOT_RADIO, profile->short_us, send_normal_packet);
+#if PERF_STATS
+        perf_gap_us = profile->short_us;
+#endif
+        dsm.receive_telem = false;
+    } else {
+        state = STATE_RECV_WAIT;
+        timer_call_next_us(TIMER_SLOT_RADIO, profile->long_us, send_normal_packet);
+#if PERF_STATS
+        perf_gap_us = profile->long_us;
+#endif
+        dsm.receive_telem = true;
+        if (profile->telem_us < profile->long_us) {
+            timer_call_after_us(TIMER_SLOT_NOISE, profile->telem_us, telem_window_end);
+#if PERF_STATS
+        } else {
+            // the window ends with the next send
+            timer_call_after_us(TIMER_SLOT_NOISE, profile->long_us - PERF_CLIP_CHECK_US, perf_clip_check);
+#endif
+        }
+    }
+
+    if (!dsm.retuned) {
+        // still in the telemetry window, force out of receive
+        write_register(CYRF_XACT_CFG, CYRF_MODE_SYNTH_TX | CYRF_FRC_END);
+        write_register(CYRF_RX_ABORT, 0);
     }
 
-    if (send_autobind) {
+    dsm.current_channel = np->hop;
+    dsm.current_rf_channel = dsm.channels[np->hop];
+
+    if (np->autobind) {
         autobind_send();
     } else {
-        dsm_set_channel(dsm.current_rf_channel, is_DSM2(),
-                        dsm.sop_col, dsm.data_col, seed);
-    
-        cypress_transmit16(pkt);
+        dsm_set_channel(dsm.current_rf_channel, dsm.pn_rows[dsm.current_channel],
+                        dsm.sop_col, dsm.data_col, np->seed);
+        // the buffer is not rebuilt until this send completes
+        queue_transmit16(np->pkt);
     }
+    PERF_END(PERF_PKT_TX);
 }
 
-
 /*
   transmit an unmodulated signal for FCC testing
  */
 static void cypress_transmit_unmodulated(void)
 {
-    write_register(CYRF_PREAMBLE,0x01);
-    write_register(CYRF_PREAMBLE,0x00);
-    write_register(CYRF_PREAMBLE,0x00);
+    queue_register(CYRF_PREAMBLE,0x01);
+    queue_register(CYRF_PREAMBLE,0x00);
+    queue_register(CYRF_PREAMBLE,0x00);
     
-    write_register(CYRF_TX_OVERRIDE, CYRF_FRC_PRE);
-    write_register(CYRF_TX_CTRL, CYRF_TX_GO);    
+    queue_register(CYRF_TX_OVERRIDE, CYRF_FRC_PRE);
+    queue_register(CYRF_TX_CTRL, CYRF_TX_GO);
+    queue_start();
 }
 
 /*
@@ -1139,7 +2002,7 @@ static void send_FCC_packet(void)
         state = STATE_SEND;
     }
     
-    timer_call_after_ms(4, send_FCC_packet);
+    timer_call_next_us(TIMER_SLOT_RADIO, 4000, send_FCC_packet);
     dsm.receive_telem = false;
 
     if (!dsm.fcc_CW_mode) {
@@ -1152,6 +2015,7 @@ static void send_FCC_packet(void)
     pkt[0] = ~dsm.mfg_id[2];
     pkt[1] = ~dsm.mfg_id[3];
 
+    channels_sample();
     for (i=0; i<7; i++) {
         int16_t v;
         uint8_t chan = i;
@@ -1181,16 +2045,19 @@ static void send_FCC_packet(void)
 
     if (dsm.power_level != dsm.FCC_test_power) {
         dsm.power_level = dsm.FCC_test_power;
-        write_register(CYRF_TX_CFG, CYRF_DATA_CODE_LENGTH | CYRF_DATA_MODE_8DR | dsm.FCC_test_power);
+        queue_register(CYRF_TX_CFG, CYRF_DATA_CODE_LENGTH | CYRF_DATA_MODE_8DR | dsm.FCC_test_power);
     }
     
     if (dsm.fcc_CW_mode) {
         if (dsm.last_CW_chan != (int8_t)dsm.FCC_test_chan) {
-            dsm_set_channel(dsm.current_rf_channel, true, dsm.sop_col, dsm.data_col, seed);
+            dsm_set_channel(dsm.current_rf_channel, dsm_pn_row(dsm.current_rf_channel, true),
+                            dsm.sop_col, dsm.data_col, seed);
 
             cypress_transmit_unmodulated();
         }
         dsm.last_CW_chan = dsm.FCC_test_chan;
+        // send any queued power change
+        queue_start();
     } else {
         if (dsm.last_CW_chan != -1) {
             dsm.last_CW_chan = -1;
@@ -1199,9 +2066,10 @@ static void send_FCC_packet(void)
             write_register(CYRF_PREAMBLE,0x33);
             write_register(CYRF_PREAMBLE,0x33);
             radio_set_config(cyrf_transfer_config, ARRAY_SIZE(cyrf_transfer_config));
-            write_register(CYRF_TX_CFG, CYRF_DATA_CODE_LENGTH | CYRF_DATA_MODE_8DR | dsm.FCC_test_power);
+            queue_register(CYRF_TX_CFG, CYRF_DATA_CODE_LENGTH | CYRF_DATA_MODE_8DR | dsm.FCC_test_power);
         }
-        dsm_set_channel(dsm.current_rf_channel, true, dsm.sop_col, dsm.data_col, seed);
+        dsm_set_channel(dsm.current_rf_channel, dsm_pn_row(dsm.current_rf_channel, true),
+                        dsm.sop_col, dsm.data_col, seed);
         cypress_transmit16(pkt);
     }
 }
@@ -1210,11 +2078,14 @@ static void send_FCC_packet(void)
 /*
    Read the MFG id from the chip
  */
-static void get_mfg_id(uint8_t mfg_id[6])
+static void get_mfg_id(uint8_t mfg_id[4])
 {
+    uint8_t id[6];
+    // the radio has a 6 byte id, DSM uses the first 4
     write_register(CYRF_MFG_ID, 0xFF);
-    spi_read_registers(CYRF_MFG_ID, mfg_id, 6);
+    spi_read_registers(CYRF_MFG_ID, id, 6);
     write_register(CYRF_MFG_ID, 0x00);
+    memcpy(mfg_id, id, 4);
 #if 0
     // this is used to match my OrangeRX TX for testing
     mfg_id[0] = 0xa5;
@@ -1235,7 +2106,11 @@ static void start_normal_send(void)
     write_register(CYRF_RX_OVERRIDE, CYRF_DIS_RXCRC);
 #endif
     dsm_setup_transfer();
-    timer_call_after_ms(10, send_normal_packet);
+#if PERF_STATS
+    perf_gap_us = 0;
+#endif
+    next_packet_ready = false;
+    timer_call_after_us(TIMER_SLOT_RADIO, 10000, send_normal_packet);
 }
 
 /*
@@ -1249,7 +2124,7 @@ static void start_FCC_send(void)
     write_register(CYRF_RX_OVERRIDE, CYRF_DIS_RXCRC);
 #endif
     dsm_setup_transfer();
-    timer_call_after_ms(10, send_FCC_packet);
+    timer_call_after_us(TIMER_SLOT_RADIO, 10000, send_FCC_packet);
 }
 
 /*
@@ -1276,10 +2151,10 @@ static void send_bind_packet(void)
     pkt[10] = 0x01;
     pkt[11] = 7; // num_channels
     if (is_DSM2()) {
-        pkt[12] = DSM_DSM2_2;
+        pkt[12] = frame_profiles[frame_profile].dsm2_protocol;
 #if SUPPORT_DSMX
     } else {
-        pkt[12] = DSM_DSMX_2;
+        pkt[12] = frame_profiles[frame_profile].dsmx_protocol;
 #endif
     }
     pkt[13] = 0;
@@ -1303,7 +2178,7 @@ static void send_bind_packet(void)
         start_normal_send();
     } else {
         // send bind every 10ms
-        timer_call_after_ms(10, send_bind_packet);
+        timer_call_next_us(TIMER_SLOT_RADIO, 10000, send_bind_packet);
     }
 }
 
@@ -1336,6 +2211,9 @@ void cypress_start_bind_send(bool use_dsm2)
     memcpy(data_code, pn_codes[0][8], 8);
     memcpy(&data_code[8], pn_bind, 8);
     write_multiple(CYRF_DATA_CODE, 16, data_code);
+    // bind codes are not in pn_codes[], so forget the cached ones
+    dsm.sop_code_id = 0;
+    dsm.data_code_id = 0;
 
     rr = adc_value(0) + adc_value(1) + adc_value(2) + adc_value(3);
     dsm.current_rf_channel = (rr % DSM_MAX_CHANNEL) | 1;
@@ -1411,6 +2289,23 @@ void cypress_start_factory_test(uint8_t test_mode)
     cypress_start_send(true);
 }
 
+/*
+  telemetry slots lost out of the last POWER_WINDOW, as seen by the
+  power controller
+ */
+uint8_t get_link_loss(void)
+{
+    return POWER_WINDOW - dsm.telem_slots_ok;
+}
+
+/*
+  averaged telemetry RSSI, as seen by the power controller
+ */
+uint8_t get_link_rssi(void)
+{
+    return (dsm.link_rssi + (1U<<(POWER_RSSI_SHIFT-1))) >> POWER_RSSI_SHIFT;
+}
+
 /*
   auto-adjust transmit power to minimise battery usage and increase
   likelyhook of connection on low battery
@@ -1419,20 +2314,40 @@ static void check_power_level(void)
 {
     uint8_t current_power_level = dsm.power_level;
 #if DYNAMIC_POWER_ADJUSTMENT
-    if (dsm.sends_since_recv > 512 && dsm.power_level < dsm.tx_max_power) {
-        dsm.power_level++;
-        dsm.sends_since_recv = 0;        
-    }
-    if (dsm.sends_since_recv > 512 && dsm.power_level == dsm.tx_max_power) {
-        dsm.power_level -= 3;
-        dsm.sends_since_recv = 0;        
-    }
-    if (dsm.sends_since_recv < 2 && dsm.sends_since_power_change > 256) {
-        if (dsm.power_level > 0 && t_status.rssi > 26) {
-            dsm.power_level--;
+    if (state == STATE_RECV_WAIT) {
+        // this send opens a telemetry slot, so the last one is over
+        uint8_t rssi = get_link_rssi();
+        uint8_t lost;
+        if (dsm.telem_slots & (1UL<<(POWER_WINDOW-1))) {
+            dsm.telem_slots_ok--;
         }
-        if (dsm.power_level < dsm.tx_max_power && t_status.rssi < 20) {
-            dsm.power_level++;
+        dsm.telem_slots <<= 1;
+        if (dsm.telem_slot_ok) {
+            dsm.telem_slots |= 1;
+            dsm.telem_slots_ok++;
+        }
+        dsm.telem_slot_ok = false;
+        if (dsm.slots_since_power_change < 0xFFFF) {
+            dsm.slots_since_power_change++;
+        }
+        lost = POWER_WINDOW - dsm.telem_slots_ok;
+
+        if (lost >= POWER_LOSS_UP &&
+            (dsm.telem_slots & ((1U<<POWER_UP_HOLD)-1)) != ((1U<<POWER_UP_HOLD)-1) &&
+            dsm.slots_since_power_change >= POWER_UP_HOLD) {
+            // loss is still happening, ramp up quickly
+            if (dsm.power_level < dsm.tx_max_power) {
+                dsm.power_level++;
+            }
+        } else if (dsm.slots_since_power_change >= POWER_DOWN_HOLD) {
+            if (lost == 0 && rssi > dsm.power_target_rssi + POWER_HYSTERESIS &&
+                dsm.power_level > 0) {
+                // stable link with margin to spare
+                dsm.power_level--;
+            } else if (rssi < dsm.power_target_rssi - POWER_HYSTERESIS &&
+                       dsm.power_level < dsm.tx_max_power) {
+                dsm.power_level++;
+            }
         }
     }
 #else
@@ -1450,28 +2365,41 @@ static void check_power_level(void)
         dsm.power_level = dsm.FCC_test_power;
     }
     if (dsm.power_level != current_power_level && state != STATE_BIND_SEND && state != STATE_AUTOBIND_SEND) {
-        dsm.sends_since_power_change = 0;
-        write_register(CYRF_TX_CFG, CYRF_DATA_CODE_LENGTH | CYRF_DATA_MODE_8DR | dsm.power_level);
+        dsm.slots_since_power_change = 0;
+        queue_register(CYRF_TX_CFG, CYRF_DATA_CODE_LENGTH | CYRF_DATA_MODE_8DR | dsm.power_level);
     }
 }
 
 /*
   transmit a 16 byte packet
-  this is a blind send, not waiting for ack or completion
+  this is a blind send, not waiting for ack or completion. The
+  packet is sent along with any queued register writes from the SPI
+  interrupt
 */
-static void cypress_transmit16(const uint8_t data[16])
+static void queue_transmit16(const uint8_t data[16])
 {
+    if (first_send_ms == 0) {
+        first_send_ms = timer_get_ms();
+    }
     check_power_level();
     
-    write_register(CYRF_TX_LENGTH, 16);
-    write_register(CYRF_TX_CTRL, CYRF_TX_CLR);
-
-    write_multiple(CYRF_TX_BUFFER, 16, data);
-    write_register(CYRF_TX_IRQ_STATUS, 0);
-    write_register(CYRF_TX_CTRL, CYRF_TX_GO | CYRF_TXC_IRQEN);
+    queue_register(CYRF_TX_LENGTH, 16);
+    queue_register(CYRF_TX_CTRL, CYRF_TX_CLR);
+    queue_multiple(CYRF_TX_BUFFER, 16, data);
+    queue_register(CYRF_TX_IRQ_STATUS, 0);
+    queue_register(CYRF_TX_CTRL, CYRF_TX_GO | CYRF_TXC_IRQEN);
+    queue_start();
     dsm.send_count++;
-    dsm.sends_since_recv++;
-    dsm.sends_since_power_change++;
+}
+
+/*
+  transmit a 16 byte packet from a buffer that may not last until the
+  queue is sent
+ */
+static void cypress_transmit16(const uint8_t data[16])
+{
+    memcpy(tx_buffer, data, 16);
+    queue_transmit16(tx_buffer);
 }
 
 uint8_t get_tx_power(void)
@@ -1527,6 +2455,38 @@ uint8_t get_telem_pps(void)
     return dsm.current_telem_pps;
 }
 
+/*
+  select the frame rate profile. Must be called before starting to
+  send or bind, as the bind packet advertises the profile
+ */
+void cypress_set_frame_profile(uint8_t profile)
+{
+    if (profile >= DSM_FRAME_NUM_PROFILES) {
+        profile = DSM_FRAME_8MS;
+    }
+    frame_profile = profile;
+}
+
+/*
+  get the active frame rate profile
+ */
+uint8_t get_frame_profile(void)
+{
+    return frame_profile;
+}
+
+/*
+  time from startup to the first packet sent, ms. Zero until then
+ */
+uint32_t get_first_send_ms(void)
+{
+    uint32_t ret;
+    __critical {
+        ret = first_send_ms;
+    }
+    return ret;
+}
+
 /*
   switch between 3 FCC test modes
  */
@@ -0,0 +1,73 @@
+/*
+  flash block programming. The CPU cannot fetch from program flash
+  while a block is being programmed, so the programming loop is copied
+  to RAM and run from there. This is shared by the bootloader and the
+  OTA receive path
+ */
+#include <stdint.h>
+#include <string.h>
+#include "stm8l.h"
+#include <eeprom.h>
+#include <flash.h>
+
+// room for the RAM copy of flash_block_ram()
+#define RAM_CODE_SIZE 48
+
+typedef void (*flash_block_fn_t)(uint8_t *dest, const uint8_t *src);
+
+static uint8_t ram_code[RAM_CODE_SIZE];
+static flash_block_fn_t ram_fn;
+
+/*
+  standard block program, which erases the block first. This is only
+  ever run from RAM so it must be position independent and call no
+  other functions. It must be immediately followed by
+  flash_block_ram_end()
+ */
+static void flash_block_ram(uint8_t *dest, const uint8_t *src)
+{
+    uint8_t n = FLASH_BLOCK_SIZE;
+    FLASH_CR2 = FLASH_CR2_PRG;
+    FLASH_NCR2 = (uint8_t)~FLASH_CR2_PRG;
+    while (n--) {
+        *dest++ = *src++;
+    }
+    while ((FLASH_IAPSR & (FLASH_IAPSR_EOP|FLASH_IAPSR_WR_PG_DIS)) == 0) ;
+}
+
+static void flash_block_ram_end(void)
+{
+}
+
+/*
+  fallback if the RAM routine does not fit, using word programming
+ */
+static void flash_block_words(uint8_t *dest, const uint8_t *src)
+{
+    uint8_t i;
+    for (i=0; i<FLASH_BLOCK_SIZE; i+=4) {
+        FLASH_CR2 = FLASH_CR2_WPRG;
+        FLASH_NCR2 = (uint8_t)~FLASH_CR2_WPRG;
+        memcpy(&dest[i], &src[i], 4);
+    }
+}
+
+void flash_write_block(uint16_t addr, const uint8_t *data)
+{
+    if (ram_fn == NULL) {
+        uint16_t size = (const uint8_t *)flash_block_ram_end - (const uint8_t *)flash_block_ram;
+        if (size <= RAM_CODE_SIZE) {
+            memcpy(ram_code, (const void *)flash_block_ram, size);
+            ram_fn = (flash_block_fn_t)ram_code;
+        } else {
+            ram_fn = flash_block_words;
+        }
+    }
+
+    progmem_unlock();
+    FLASH_CR1 = 0;
+    __critical {
+        ram_fn((uint8_t *)addr, data);
+    }
+    progmem_lock();
+}
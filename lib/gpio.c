@@ -71,3 +71,11 @@ bool gpio_get(uint16_t pin)
     pin &= 0xFF;
     return (g->IDR & pin) != 0;
 }
+
+/*
+  read all input pins of a port, GPIO_PORTx >> 8
+ */
+uint8_t gpio_read_port(uint8_t port)
+{
+    return gpio[port].IDR;
+}
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include "uart.h"
+#include "util.h"
+#include "logtok.h"
+
+#if LOG_TOKENS
+
+/*
+  fixed wire size of the arguments, with one byte for the terminator
+  of each string
+ */
+static uint8_t fixed_len(uint8_t nargs, uint32_t spec)
+{
+    static const uint8_t arg_len[4] = { 2, 4, 1, 1 };
+    uint8_t len = 0;
+    while (nargs--) {
+        len += arg_len[spec & 3];
+        spec >>= 2;
+    }
+    return len;
+}
+
+/*
+  send one tokenized message. The message is built in a local buffer
+  and queued as one block, so it is safe to call from interrupt
+  handlers and a full UART buffer drops whole messages
+ */
+void log_token(uint16_t id, uint32_t spec, ...)
+{
+    uint8_t msg[LOGTOK_MAX_MSG];
+    uint8_t nargs = id >> 12;
+    uint8_t len = 3;
+    uint8_t str_room;
+    va_list ap;
+
+    msg[0] = LOGTOK_SYNC;
+    msg[1] = id >> 8;
+    msg[2] = id & 0xFF;
+    str_room = LOGTOK_MAX_MSG - len - fixed_len(nargs, spec);
+
+    va_start(ap, spec);
+    while (nargs--) {
+        switch (spec & 3) {
+        case LOGTOK_ARG_INT: {
+            uint16_t v = va_arg(ap, unsigned int);
+            msg[len++] = v >> 8;
+            msg[len++] = v & 0xFF;
+            break;
+        }
+        case LOGTOK_ARG_LONG: {
+            uint32_t v = va_arg(ap, unsigned long);
+            msg[len++] = v >> 24;
+            msg[len++] = (v >> 16) & 0xFF;
+            msg[len++] = (v >> 8) & 0xFF;
+            msg[len++] = v & 0xFF;
+            break;
+        }
+        case LOGTOK_ARG_CHAR:
+            msg[len++] = va_arg(ap, unsigned char);
+            break;
+        case LOGTOK_ARG_STR: {
+            const char *s = va_arg(ap, const char *);
+            while (*s && str_room != 0) {
+                msg[len++] = *s++;
+                str_room--;
+            }
+            msg[len++] = 0;
+            break;
+        }
+        }
+        spec >>= 2;
+    }
+    va_end(ap);
+
+    uart2_write_block(msg, len);
+}
+
+#endif // LOG_TOKENS
@@ -0,0 +1,152 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "stm8l.h"
+#include <config.h>
+#include <gpio.h>
+#include <util.h>
+#include <perf.h>
+
+#if PERF_STATS
+
+struct perf_stat {
+    uint16_t min_us;
+    uint16_t max_us;
+    uint16_t count;
+    uint16_t hist[PERF_HIST_BUCKETS];
+};
+
+static struct perf_stat stats[PERF_NUM_IDS];
+static uint16_t start_us[PERF_NUM_IDS];
+static uint16_t clip_count;
+static uint8_t report_hist;
+
+static const char *const names[PERF_NUM_IDS] = {
+    "IRQ", "ADC", "TICK", "BUILD", "TX", "JIT"
+};
+
+void perf_init(void)
+{
+#ifdef PERF_PIN
+    gpio_config(PERF_PIN, GPIO_OUTPUT_PUSHPULL_FAST|GPIO_CLEAR);
+#endif
+}
+
+/*
+  low 16 bits of the microsecond clock. Only called from interrupt
+  handlers, which don't nest, so the latched read of the counter is
+  not disturbed
+ */
+static uint16_t perf_now(void)
+{
+    uint16_t t = ((uint16_t)TIM2_CNTRH) << 8;
+    t |= TIM2_CNTRL;
+    return t;
+}
+
+void perf_begin(uint8_t id)
+{
+#ifdef PERF_PIN
+    if (PERF_PIN_MASK & (1U<<id)) {
+        gpio_set(PERF_PIN);
+    }
+#endif
+    start_us[id] = perf_now();
+}
+
+void perf_end(uint8_t id)
+{
+    perf_record(id, perf_now() - start_us[id]);
+#ifdef PERF_PIN
+    if (PERF_PIN_MASK & (1U<<id)) {
+        gpio_clear(PERF_PIN);
+    }
+#endif
+}
+
+/*
+  add a time to the stats of a phase
+ */
+void perf_record(uint8_t id, uint16_t us)
+{
+    struct perf_stat *s = &stats[id];
+    uint16_t v = us >> 4;
+    uint8_t b = 0;
+
+    while (v != 0 && b < PERF_HIST_BUCKETS-1) {
+        v >>= 1;
+        b++;
+    }
+    if (s->count == 0 || us < s->min_us) {
+        s->min_us = us;
+    }
+    if (us > s->max_us) {
+        s->max_us = us;
+    }
+    if (s->count != 0xFFFF) {
+        s->count++;
+    }
+    if (s->hist[b] != 0xFFFF) {
+        s->hist[b]++;
+    }
+}
+
+/*
+  count a telemetry receive window cut short by the next send
+ */
+void perf_count_clip(void)
+{
+    clip_count++;
+}
+
+/*
+  largest time of a phase since the last report
+ */
+uint16_t perf_max_us(uint8_t id)
+{
+    uint16_t ret;
+    __critical {
+        ret = stats[id].max_us;
+    }
+    return ret;
+}
+
+/*
+  print min/max/count of each phase and the histogram of one phase in
+  turn, then start a new period. Called from the main loop
+ */
+void perf_report(void)
+{
+    struct perf_stat s;
+    uint16_t clips;
+    uint8_t i;
+
+    printf("PERF");
+    for (i=0; i<PERF_NUM_IDS; i++) {
+        __critical {
+            memcpy(&s, &stats[i], sizeof(s));
+            if (i != report_hist) {
+                memset(&stats[i], 0, sizeof(s));
+            }
+        }
+        printf(" %s:%u/%u/%u", names[i], s.min_us, s.max_us, s.count);
+    }
+    __critical {
+        clips = clip_count;
+        clip_count = 0;
+    }
+    printf(" CLIP:%u\n", clips);
+
+    __critical {
+        memcpy(&s, &stats[report_hist], sizeof(s));
+        memset(&stats[report_hist], 0, sizeof(s));
+    }
+    printf("HIST %s:", names[report_hist]);
+    for (i=0; i<PERF_HIST_BUCKETS; i++) {
+        printf(" %u", s.hist[i]);
+    }
+    printf("\n");
+    report_hist = (report_hist + 1) % PERF_NUM_IDS;
+}
+
+#endif // PERF_STATS
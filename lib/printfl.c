@@ -50,6 +50,9 @@
 #include <stdarg.h>
 #include "uart.h"
 
+// with LOG_TOKENS printf is replaced by log_token, see logtok.c
+#if !LOG_TOKENS
+
 static char radix;
 static bool long_flag = 0;
 static bool string_flag = 0;
@@ -210,3 +213,4 @@ void printf(const char *fmt, ...)
 	vprintfl(fmt, ap);
 }
 
+#endif // !LOG_TOKENS
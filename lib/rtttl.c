@@ -0,0 +1,147 @@
+/*
+  RTTTL parser, based on ToneAlarm code from ArduPilot
+
+  This is used by the mktunes host tool to convert the built in tunes
+  at build time, and on the transmitter for uploaded tunes. It must
+  not use any hardware
+ */
+#include <rtttl.h>
+
+#define isdigit(c) ((c)>='0' && (c)<='9')
+
+/*
+  parse a RTTTL tune into at most max_notes notes, returning the
+  number of notes. The tune name is skipped
+ */
+uint8_t rtttl_parse(const char *tune, struct rtttl_note *notes, uint8_t max_notes)
+{
+    uint8_t default_oct = 6;
+    uint16_t bpm = 63;
+    uint16_t wholenote;
+    uint16_t num;
+    uint8_t count = 0;
+
+    // skip the name
+    while (*tune != ':') {
+        if (*tune == '\0') {
+            return 0;
+        }
+        tune++;
+    }
+    tune++;
+
+    // the default duration is parsed but, as in ArduPilot, notes
+    // without a duration are always quarter notes
+    if (*tune == 'd') {
+        tune += 2;
+        while (isdigit(*tune)) {
+            tune++;
+        }
+        tune++;
+    }
+
+    // get default octave
+    if (*tune == 'o') {
+        tune += 2;
+        num = *tune++ - '0';
+        if (num >= 3 && num <= 7) {
+            default_oct = num;
+        }
+        tune++;
+    }
+
+    // get BPM
+    if (*tune == 'b') {
+        tune += 2;
+        num = 0;
+        while (isdigit(*tune)) {
+            num = (num * 10) + (*tune++ - '0');
+        }
+        bpm = num;
+        tune++;
+    }
+
+    if (bpm == 0) {
+        return 0;
+    }
+    wholenote = (60 * ((uint32_t)1000) / bpm) * 4;
+
+    while (*tune != '\0' && count < max_notes) {
+        uint16_t duration;
+        uint8_t note;
+        uint8_t scale;
+
+        // first, get note duration, if available
+        num = 0;
+        while (isdigit(*tune)) {
+            num = (num * 10) + (*tune++ - '0');
+        }
+        if (num) {
+            duration = wholenote / num;
+        } else {
+            duration = wholenote / 4;
+        }
+
+        // now get the note
+        switch (*tune) {
+        case 'c':
+            note = 1;
+            break;
+        case 'd':
+            note = 3;
+            break;
+        case 'e':
+            note = 5;
+            break;
+        case 'f':
+            note = 6;
+            break;
+        case 'g':
+            note = 8;
+            break;
+        case 'a':
+            note = 10;
+            break;
+        case 'b':
+            note = 12;
+            break;
+        case 'p':
+        default:
+            note = 0;
+        }
+        if (*tune != '\0') {
+            tune++;
+        }
+
+        // now, get optional '#' sharp
+        if (*tune == '#') {
+            note++;
+            tune++;
+        }
+
+        // now, get optional '.' dotted note
+        if (*tune == '.') {
+            duration += duration/2;
+            tune++;
+        }
+
+        // now, get scale
+        if (isdigit(*tune)) {
+            scale = *tune++ - '0';
+        } else {
+            scale = default_oct;
+        }
+
+        if (*tune == ',') {
+            tune++;
+        }
+
+        if (note) {
+            note = (scale - 4) * 12 + note;
+        }
+        notes[count].note = note;
+        notes[count].duration_ms = duration;
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <eeprom.h>
+#include <crc.h>
+#include <timer.h>
+#include <settings.h>
+
+/*
+  settings journal. Each record is a sequence number, all settings and
+  a check byte, and each save writes a new record to the slot after
+  the newest one, so wear is spread over the whole journal. The check
+  byte is the inverted CRC8 of the rest of the record, so erased cells
+  never form a valid record, and it is written last so a save cut
+  short by power loss leaves the previous record newest.
+
+  Only one EEPROM byte is programmed per settings_update() call, so
+  saving doesn't stall the main loop for a whole record
+ */
+#define RECORD_LEN (SETTINGS_NUM+2)
+#define NUM_RECORDS (EEPROM_JOURNAL_SIZE / RECORD_LEN)
+
+static uint8_t values[SETTINGS_NUM];
+static uint8_t record[RECORD_LEN];
+static uint8_t write_pos = RECORD_LEN; // RECORD_LEN when no save is running
+static uint8_t next_slot;
+static uint8_t seq;
+static bool dirty;
+static uint32_t change_ms;
+
+static uint8_t record_check(const uint8_t *rec)
+{
+    return ~crc_crc8(rec, RECORD_LEN-1);
+}
+
+/*
+  load the newest valid record. Sequence numbers in use span less than
+  half their range, so the newest is found by serial number compare
+ */
+void settings_init(void)
+{
+    uint8_t rec[RECORD_LEN];
+    bool found = false;
+    uint8_t slot, i;
+
+    write_pos = RECORD_LEN;
+    dirty = false;
+    seq = 0;
+    next_slot = 0;
+    for (slot=0; slot<NUM_RECORDS; slot++) {
+        uint16_t ofs = EEPROM_JOURNAL_OFFSET + slot*RECORD_LEN;
+        for (i=0; i<RECORD_LEN; i++) {
+            rec[i] = eeprom_read(ofs+i);
+        }
+        if (rec[RECORD_LEN-1] != record_check(rec)) {
+            continue;
+        }
+        if (!found || (int8_t)(rec[0] - seq) > 0) {
+            found = true;
+            seq = rec[0];
+            next_slot = (slot+1) % NUM_RECORDS;
+            memcpy(values, &rec[1], SETTINGS_NUM);
+        }
+    }
+    if (!found) {
+        // start from the settings of older firmware
+        for (i=0; i<SETTINGS_NUM; i++) {
+            values[i] = eeprom_read(i);
+        }
+    }
+}
+
+uint8_t settings_get(uint8_t id)
+{
+    return values[id];
+}
+
+void settings_set(uint8_t id, uint8_t value)
+{
+    if (values[id] != value) {
+        values[id] = value;
+        dirty = true;
+        change_ms = timer_get_ms();
+    }
+}
+
+/*
+  start a save of the current values. Settings changed while it runs
+  go in the next record
+ */
+static void start_record(void)
+{
+    seq++;
+    record[0] = seq;
+    memcpy(&record[1], values, SETTINGS_NUM);
+    record[RECORD_LEN-1] = record_check(record);
+    dirty = false;
+    write_pos = 0;
+}
+
+static void write_next_byte(void)
+{
+    eeprom_write(EEPROM_JOURNAL_OFFSET + next_slot*RECORD_LEN + write_pos, record[write_pos]);
+    write_pos++;
+    if (write_pos == RECORD_LEN) {
+        next_slot = (next_slot+1) % NUM_RECORDS;
+    }
+}
+
+/*
+  write back changed settings a byte at a time once they have been
+  stable for SETTINGS_FLUSH_MS. Called from the main loop
+ */
+void settings_update(void)
+{
+    if (write_pos == RECORD_LEN) {
+        if (!dirty || timer_get_ms() - change_ms < SETTINGS_FLUSH_MS) {
+            return;
+        }
+        start_record();
+    }
+    write_next_byte();
+}
+
+/*
+  write back changed settings now, before powering off
+ */
+void settings_flush(void)
+{
+    while (dirty || write_pos != RECORD_LEN) {
+        if (write_pos == RECORD_LEN) {
+            start_record();
+        }
+        write_next_byte();
+    }
+}
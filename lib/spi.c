@@ -12,10 +12,19 @@ static bool forced_chip_select = false;
 
 static volatile uint8_t dummy;
 
+/*
+  state of the interrupt driven write queue. The caller owns the
+  list of writes until the completion callback has run
+ */
+static const struct spi_write *q_writes;
+static volatile uint8_t q_count;
+static uint8_t q_pos;
+static spi_callback_t q_callback;
+
 void spi_init(void)
 {
     // enable SPI clock
-    CLK_SPCKENR1 |= 0x20;
+    CLK_SPCKENR1 |= CLK_SPCKENR1_SPI;
 
     gpio_config(SPI_SCK, GPIO_OUTPUT_PUSHPULL);
     gpio_config(SPI_MOSI, GPIO_OUTPUT_PUSHPULL);
@@ -48,6 +57,19 @@ void spi_init(void)
     dummy = SPI_SR;
 }
 
+/*
+  set the SPI clock to the master clock divided by 2^(br+1). Used by
+  spibench, the firmware keeps the spi_init() rate
+ */
+void spi_set_clock_div(uint8_t br)
+{
+    spi_queue_wait();
+    while (SPI_SR & SPI_SR_BSY) ;
+    SPI_CR1 &= ~0x40;
+    SPI_CR1 = (SPI_CR1 & ~(0x7<<3)) | ((br & 0x7)<<3);
+    SPI_CR1 |= 0x40;
+}
+
 static void spi_radio_cs_high(void)
 {
     gpio_set(SPI_NCS_PIN);
@@ -60,6 +82,7 @@ static void spi_radio_cs_low(void)
 
 void spi_force_chip_select(bool set)
 {
+    spi_queue_wait();
     if (set && !forced_chip_select) {
         forced_chip_select = true;
         spi_radio_cs_low();
@@ -85,20 +108,23 @@ uint8_t spi_read1(void)
 
 void spi_transfer(uint8_t n, const uint8_t *sendbuf, uint8_t *recvbuf)
 {
+    // blocking transfers go after any queued writes
+    spi_queue_wait();
+
     if (!forced_chip_select) {
         spi_radio_cs_low();
     }
 
     while (n--) {
         // wait for tx buffer to be empty
-        while ((SPI_SR & 0x02) == 0) ;
+        while ((SPI_SR & SPI_SR_TXE) == 0) ;
         if (sendbuf == NULL) {
             SPI_DR = dummy;
         } else {
             SPI_DR = *sendbuf++;
         }
 
-        while ((SPI_SR & 0x01) == 0) ;
+        while ((SPI_SR & SPI_SR_RXNE) == 0) ;
 
         // wait for incoming byte
         if (recvbuf == NULL) {
@@ -123,3 +149,122 @@ void spi_read_registers(uint8_t reg, uint8_t *buf, uint8_t len)
 
     spi_force_chip_select(old_force);
 }
+
+/*
+  send the next byte of the current queued write
+ */
+static void spi_queue_next_byte(void)
+{
+    const struct spi_write *w = q_writes;
+    if (q_pos == 0) {
+        SPI_DR = w->reg;
+    } else if (w->data == NULL) {
+        SPI_DR = w->value;
+    } else {
+        SPI_DR = w->data[q_pos-1];
+    }
+    q_pos++;
+}
+
+/*
+  start sending a list of register writes from the SPI interrupt. The
+  callback is called from interrupt context when the last write has
+  completed
+ */
+void spi_queue_start(const struct spi_write *writes, uint8_t count, spi_callback_t callback)
+{
+    // only one queue can be in flight
+    spi_queue_wait();
+
+    if (count == 0) {
+        if (callback != NULL) {
+            callback();
+        }
+        return;
+    }
+
+    q_writes = writes;
+    q_callback = callback;
+    q_pos = 0;
+    q_count = count;
+
+    // clear any stale receive byte
+    dummy = SPI_DR;
+
+    spi_radio_cs_low();
+    SPI_ICR = SPI_ICR_RXIE;
+    spi_queue_next_byte();
+}
+
+/*
+  return true if a queue of writes is in flight
+ */
+bool spi_queue_busy(void)
+{
+    return q_count != 0;
+}
+
+/*
+  complete any in flight queue by polling. This is safe to call from
+  interrupt context, as it does not rely on the SPI interrupt. The
+  poll runs with interrupts masked, as from the main loop an SPI
+  interrupt already pending could otherwise run spi_irq() alongside
+  it. Once unmasked that interrupt finds nothing left to do
+ */
+void spi_queue_wait(void)
+{
+    __critical {
+        if (q_count != 0) {
+            SPI_ICR = 0;
+            while (q_count != 0) {
+                spi_irq();
+            }
+        }
+    }
+}
+
+/*
+  SPI interrupt handler. We pace the queue on RXNE rather than TXE so
+  that chip select is only raised once the last byte is fully clocked
+  out
+ */
+void spi_irq(void)
+{
+    spi_callback_t callback;
+
+    if ((SPI_SR & SPI_SR_RXNE) == 0) {
+        return;
+    }
+    dummy = SPI_DR;
+
+    if (q_count == 0) {
+        SPI_ICR = 0;
+        return;
+    }
+
+    if (q_pos <= q_writes->len) {
+        // more bytes in this write
+        spi_queue_next_byte();
+        return;
+    }
+
+    // this write is complete
+    spi_radio_cs_high();
+    q_writes++;
+    q_pos = 0;
+
+    if (q_count > 1) {
+        q_count--;
+        spi_radio_cs_low();
+        spi_queue_next_byte();
+        return;
+    }
+
+    SPI_ICR = 0;
+    callback = q_callback;
+    q_callback = NULL;
+    q_count = 0;
+    if (callback != NULL) {
+        callback();
+    }
+}
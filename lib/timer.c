@@ -4,10 +4,26 @@
 #include <gpio.h>
 #include <config.h>
 #include <buzzer.h>
+#include <adc.h>
+#include <buttons.h>
 
 static volatile uint32_t g_time_ms;
-static volatile uint32_t g_callback_t_ms;
-static volatile timer_callback_t g_callback;
+
+/*
+  TIM2 runs free at 1MHz. The top 16 bits of the microsecond clock
+  are counted on overflow and the CC1 compare is used to wake up for
+  the earliest pending slot
+ */
+static volatile uint16_t g_time_us_high;
+
+static struct {
+    volatile timer_callback_t callback;
+    uint32_t deadline_us;
+    struct timer_stats stats;
+} slots[TIMER_NUM_SLOTS];
+
+// deadlines closer than this are run now rather than waiting for a compare
+#define TIMER_MIN_US 20
 
 void timer_init(void)
 {
@@ -17,6 +33,22 @@ void timer_init(void)
     // enable interrupt
     TIM4_IER = TIM_IER_UIE;
     TIM4_CR1 = TIM_CR1_URS | TIM_CR1_CEN;
+
+    // prescale 16 for a 1MHz count, full 16 bit range
+#if CLOCK_DIV == CLOCK_DIV_16MHZ
+    TIM2_PSCR = 4;
+#else
+    TIM2_PSCR = 1;
+#endif
+    TIM2_ARRH = 0xFF;
+    TIM2_ARRL = 0xFF;
+    // CC1 as frozen output compare, no pin output
+    TIM2_CCMR1 = 0;
+    TIM2_CCER1 = 0;
+    TIM2_EGR = TIM_EGR_UG;
+    TIM2_SR1 = 0;
+    TIM2_IER = TIM_IER_UIE;
+    TIM2_CR1 = TIM_CR1_URS | TIM_CR1_CEN;
 }
 
 static uint16_t power_pin_count;
@@ -29,11 +61,9 @@ void timer_irq(void)
         bool pin_user;
         // we have overflowed, increment ms counter
         g_time_ms++;
-        if (g_callback_t_ms != 0 && g_time_ms >= g_callback_t_ms && g_callback != NULL) {
-            g_callback_t_ms = 0;
-            g_callback();
-        }
-        pin_user = gpio_get(PIN_USER);
+        adc_start();
+        buttons_tick();
+        pin_user = (get_buttons() & BUTTON_POWER) != 0;
         if (!pin_user) {
             // only activate if its been off at least once since boot
             activate_power_pin = true;
@@ -46,7 +76,7 @@ void timer_irq(void)
             if (power_pin_count > POWER_OFF_MS) {
                 // clear power control
                 gpio_clear(PIN_POWER);
-                buzzer_tune(TONE_ERROR_TUNE);
+                buzzer_tune_blocking(TONE_ERROR_TUNE);
                 // loop forever
                 while (true) ;
             }
@@ -63,10 +93,246 @@ uint32_t timer_get_ms(void)
     return g_time_ms;
 }
 
-void timer_call_after_ms(uint16_t dt_ms, timer_callback_t callback)
+#if IDLE_STATS
+static uint32_t idle_us;
+static uint32_t idle_period_start_us;
+#endif
+
+/*
+  sleep until the next interrupt. The 1ms tick wakes us at the latest,
+  so callers can poll for work between calls.
+
+  With IDLE_STATS the time spent waiting is accumulated. This includes
+  the handler of the interrupt that wakes us, so the idle fraction is
+  slightly overestimated
+ */
+void timer_idle(void)
+{
+#if IDLE_STATS
+    uint32_t t0 = micros();
+    wfi();
+    idle_us += micros() - t0;
+#else
+    wfi();
+#endif
+}
+
+/*
+  percentage of time spent in timer_idle() since the last call, or 0
+  without IDLE_STATS
+ */
+uint8_t timer_idle_percent(void)
+{
+#if IDLE_STATS
+    uint32_t now = micros();
+    uint32_t period = now - idle_period_start_us;
+    uint8_t ret = 0;
+    if (period >= 100) {
+        ret = idle_us / (period / 100);
+        if (ret > 100) {
+            ret = 100;
+        }
+    }
+    idle_us = 0;
+    idle_period_start_us = now;
+    return ret;
+#else
+    return 0;
+#endif
+}
+
+/*
+  time since boot in microseconds. This is safe to call from
+  interrupt context
+ */
+uint32_t micros(void)
+{
+    uint16_t high;
+    uint16_t cnt;
+    bool overflow_pending;
+
+    do {
+        high = g_time_us_high;
+        // reading the high byte latches the low byte
+        cnt = ((uint16_t)TIM2_CNTRH) << 8;
+        cnt |= TIM2_CNTRL;
+        overflow_pending = (TIM2_SR1 & TIM_SR1_UIF) != 0;
+    } while (high != g_time_us_high);
+
+    if (overflow_pending && cnt < 0x8000) {
+        // overflow not yet counted by the interrupt
+        high++;
+    }
+
+    return (((uint32_t)high) << 16) | cnt;
+}
+
+/*
+  setup the CC1 compare for the earliest pending slot. Returns false
+  if a slot is already due and should be run now
+ */
+static bool timer_program_next(void)
+{
+    uint8_t i;
+    bool have_next = false;
+    uint32_t next_us = 0;
+    uint32_t now = micros();
+
+    for (i=0; i<TIMER_NUM_SLOTS; i++) {
+        if (slots[i].callback == NULL) {
+            continue;
+        }
+        if (!have_next || (int32_t)(slots[i].deadline_us - next_us) < 0) {
+            next_us = slots[i].deadline_us;
+            have_next = true;
+        }
+    }
+    if (!have_next) {
+        TIM2_IER = TIM_IER_UIE;
+        return true;
+    }
+    if ((int32_t)(next_us - now) < TIMER_MIN_US) {
+        return false;
+    }
+    TIM2_CCR1H = next_us >> 8;
+    TIM2_CCR1L = next_us & 0xFF;
+    TIM2_SR1 = (uint8_t)~TIM_SR1_CC1IF;
+    TIM2_IER = TIM_IER_UIE | TIM_IER_CC1IE;
+
+    // we may have passed the deadline while setting up the compare
+    if ((int32_t)(next_us - micros()) < TIMER_MIN_US) {
+        TIM2_EGR = TIM_EGR_CC1G;
+    }
+    return true;
+}
+
+/*
+  run all slots that are due, then setup for the next one
+ */
+static void timer_run_slots(void)
+{
+    uint8_t i;
+
+    do {
+        for (i=0; i<TIMER_NUM_SLOTS; i++) {
+            timer_callback_t callback = slots[i].callback;
+            uint32_t late_us;
+            uint32_t start_us;
+            uint32_t run_us;
+            if (callback == NULL) {
+                continue;
+            }
+            late_us = micros() - slots[i].deadline_us;
+            if ((int32_t)late_us < -TIMER_MIN_US) {
+                continue;
+            }
+            if ((int32_t)late_us < 0) {
+                late_us = 0;
+            }
+            if (late_us > 0xFFFF) {
+                late_us = 0xFFFF;
+            }
+            slots[i].stats.calls++;
+            if (late_us > TIMER_LATE_US) {
+                slots[i].stats.late_count++;
+            }
+            if (late_us > slots[i].stats.max_late_us) {
+                slots[i].stats.max_late_us = late_us;
+            }
+            slots[i].callback = NULL;
+            start_us = micros();
+            callback();
+            run_us = micros() - start_us;
+            if (run_us > 0xFFFF) {
+                run_us = 0xFFFF;
+            }
+            if (run_us > slots[i].stats.max_run_us) {
+                slots[i].stats.max_run_us = run_us;
+            }
+        }
+    } while (!timer_program_next());
+}
+
+/*
+  TIM2 interrupt, for both overflow and compare
+ */
+void timer2_irq(void)
+{
+    uint8_t sr = TIM2_SR1;
+    if (sr & TIM_SR1_UIF) {
+        g_time_us_high++;
+        TIM2_SR1 = (uint8_t)~TIM_SR1_UIF;
+    }
+    if (sr & TIM_SR1_CC1IF) {
+        TIM2_SR1 = (uint8_t)~TIM_SR1_CC1IF;
+        timer_run_slots();
+    }
+}
+
+/*
+  set the deadline of a slot. This is called from both the main loop
+  and interrupt handlers, so interrupts are masked while the slot and
+  TIM2_IER change. Masking only TIM2_IER would let an interrupt that
+  reprograms the timer run between the mask and the re-enable
+ */
+static void timer_set_slot(uint8_t slot, uint32_t deadline_us, timer_callback_t callback)
+{
+    __critical {
+        slots[slot].deadline_us = deadline_us;
+        slots[slot].callback = callback;
+        if (!timer_program_next()) {
+            // already due, let the compare interrupt run it
+            TIM2_IER = TIM_IER_UIE | TIM_IER_CC1IE;
+            TIM2_EGR = TIM_EGR_CC1G;
+        }
+    }
+}
+
+/*
+  call the callback from interrupt context dt_us microseconds from now
+ */
+void timer_call_after_us(uint8_t slot, uint32_t dt_us, timer_callback_t callback)
+{
+    timer_set_slot(slot, micros() + dt_us, callback);
+}
+
+/*
+  call the callback dt_us microseconds after the last deadline of this
+  slot. Used from a slot's callback this gives a fixed period without
+  drift from interrupt latency
+ */
+void timer_call_next_us(uint8_t slot, uint32_t dt_us, timer_callback_t callback)
+{
+    uint32_t deadline_us = slots[slot].deadline_us + dt_us;
+    if ((int32_t)(micros() - deadline_us) > (int32_t)dt_us) {
+        // we have fallen too far behind, restart the period from now
+        deadline_us = micros() + dt_us;
+    }
+    timer_set_slot(slot, deadline_us, callback);
+}
+
+/*
+  cancel any pending callback on a slot
+ */
+void timer_cancel(uint8_t slot)
+{
+    timer_set_slot(slot, slots[slot].deadline_us, NULL);
+}
+
+/*
+  return true if a slot has a pending callback
+ */
+bool timer_pending(uint8_t slot)
+{
+    return slots[slot].callback != NULL;
+}
+
+/*
+  get the lateness statistics for a slot
+ */
+struct timer_stats *timer_get_stats(uint8_t slot)
 {
-    g_callback = callback;
-    g_callback_t_ms = g_time_ms + dt_ms;
+    return &slots[slot].stats;
 }
 
 void timer_delay_ms(uint16_t ms)
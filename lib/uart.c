@@ -3,6 +3,16 @@
 #include "stm8l.h"
 #include "config.h"
 
+/*
+  transmit ring buffer, drained by the UART2 TXE interrupt. A uint8_t
+  index wraps at the buffer size. When full, new bytes are dropped
+  rather than waiting, so logging never stalls the radio
+ */
+static volatile uint8_t tx_buf[256];
+static volatile uint8_t tx_head;
+static volatile uint8_t tx_tail;
+static volatile uint16_t tx_dropped;
+
 void uart2_init(void)
 {
     PD_DDR |= 0x20; // Put TX line on
@@ -21,10 +31,59 @@ void uart2_init(void)
 #endif
 }
 
+/*
+  change the baudrate. The transmit buffer should be flushed first
+ */
+void uart2_set_baudrate(uint32_t baudrate)
+{
+#if CLOCK_DIV == CLOCK_DIV_2MHZ
+    uint16_t div = 2000000UL / baudrate;
+#else // 16MHz fMASTER
+    uint16_t div = 16000000UL / baudrate;
+#endif
+    // BRR2 must be written before BRR1
+    UART2_BRR2 = ((div >> 8) & 0xF0) | (div & 0x0F);
+    UART2_BRR1 = (div >> 4) & 0xFF;
+}
+
+/*
+  enable the receiver. Received bytes are polled with uart2_read()
+ */
+void uart2_enable_rx(void)
+{
+    UART2_CR2 |= UART_CR2_REN;
+}
+
+/*
+  read one byte if available
+ */
+bool uart2_read(uint8_t *c)
+{
+    uint8_t sr = UART2_SR;
+    if (sr & UART_SR_RXNE) {
+        *c = UART2_DR;
+        return true;
+    }
+    if (sr & UART_SR_OR) {
+        // clear overrun by reading DR
+        *c = UART2_DR;
+    }
+    return false;
+}
+
 void uart2_putchar(char c)
 {
-    while(!(UART2_SR & UART_SR_TXE)) ;
-    UART2_DR = c;
+    // we can be called from both interrupt and main context
+    __critical {
+        uint8_t next = tx_head+1;
+        if (next == tx_tail) {
+            tx_dropped++;
+        } else {
+            tx_buf[tx_head] = c;
+            tx_head = next;
+            UART2_CR2 |= UART_CR2_TIEN;
+        }
+    }
 }
 
 void uart2_write(const char *str)
@@ -34,3 +93,53 @@ void uart2_write(const char *str)
     }
 }
 
+/*
+  queue a block of bytes, or drop all of them if they don't fit, so a
+  binary message is never cut short
+ */
+void uart2_write_block(const uint8_t *buf, uint8_t len)
+{
+    __critical {
+        if ((uint8_t)(tx_tail - tx_head - 1) < len) {
+            tx_dropped += len;
+        } else {
+            while (len--) {
+                tx_buf[tx_head++] = *buf++;
+            }
+            UART2_CR2 |= UART_CR2_TIEN;
+        }
+    }
+}
+
+/*
+  UART2 transmit interrupt, send the next byte from the ring buffer
+ */
+void uart2_tx_irq(void)
+{
+    if (tx_tail == tx_head) {
+        UART2_CR2 &= ~UART_CR2_TIEN;
+        return;
+    }
+    UART2_DR = tx_buf[tx_tail];
+    tx_tail++;
+}
+
+/*
+  send everything in the ring buffer by polling. Used when interrupts
+  are about to be disabled
+ */
+void uart2_flush(void)
+{
+    while (tx_tail != tx_head) {
+        while (!(UART2_SR & UART_SR_TXE)) ;
+        uart2_tx_irq();
+    }
+}
+
+/*
+  number of bytes dropped because the ring buffer was full
+ */
+uint16_t uart2_tx_dropped(void)
+{
+    return tx_dropped;
+}
@@ -0,0 +1,158 @@
+/*
+  receive a firmware image over UART2 into the NEW_FIRMWARE_BASE slot,
+  for fast loading on the production line. See uartfw.h for the
+  protocol
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "stm8l.h"
+#include <config.h>
+#include <util.h>
+#include <uart.h>
+#include <timer.h>
+#include <crc.h>
+#include <flash.h>
+#include <uartfw.h>
+#include <blimage.h>
+
+// maximum size of the staging slot
+#define UARTFW_SLOT_SIZE (16*1024U)
+
+// give up on a partial frame after this long
+#define UARTFW_BYTE_TIMEOUT_MS 500
+
+static uint8_t frame[UARTFW_HEADER_LEN-2 + UARTFW_BLOCK_SIZE + 1];
+
+/*
+  wait for one byte, returning false on timeout
+ */
+static bool read_byte(uint8_t *c)
+{
+    uint32_t start_ms = timer_get_ms();
+    while (!uart2_read(c)) {
+        if (timer_get_ms() - start_ms > UARTFW_BYTE_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void send_reply(uint8_t status, uint16_t offset)
+{
+    uart2_putchar(UARTFW_SYNC1);
+    uart2_putchar(UARTFW_SYNC2);
+    uart2_putchar(status);
+    uart2_putchar(offset >> 8);
+    uart2_putchar(offset & 0xFF);
+}
+
+/*
+  check the size and CRC of the image in the slot, as the bootloader
+  will
+ */
+static bool image_valid(void)
+{
+    uint16_t size = *(uint16_t *)NEW_FIRMWARE_BASE;
+    uint32_t crc = *(uint32_t *)(NEW_FIRMWARE_BASE+2);
+    if (size == FW_COMPRESSED_MAGIC) {
+        uint16_t zsize = *(uint16_t *)(NEW_FIRMWARE_BASE+6);
+        if (zsize > UARTFW_SLOT_SIZE-FW_COMPRESSED_HEADER_LEN) {
+            return false;
+        }
+        return crc_crc32((const uint8_t *)(NEW_FIRMWARE_BASE+FW_COMPRESSED_HEADER_LEN), zsize) == crc;
+    }
+    if (size < 0x1000 || size > (NEW_FIRMWARE_BASE-CODELOC)) {
+        return false;
+    }
+    return crc_crc32((const uint8_t *)(NEW_FIRMWARE_BASE+FW_HEADER_LEN), size) == crc;
+}
+
+/*
+  receive one frame into frame[], returning false on a bad frame
+ */
+static bool read_frame(void)
+{
+    uint8_t c;
+    uint8_t i;
+    uint8_t len;
+
+    // find the sync bytes
+    do {
+        while (!uart2_read(&c) || c != UARTFW_SYNC1) ;
+        if (!read_byte(&c)) {
+            return false;
+        }
+    } while (c != UARTFW_SYNC2);
+
+    // offset and length
+    for (i=0; i<3; i++) {
+        if (!read_byte(&frame[i])) {
+            return false;
+        }
+    }
+    len = frame[2];
+    if (len > UARTFW_BLOCK_SIZE) {
+        return false;
+    }
+    // data and crc
+    for (i=0; i<=len; i++) {
+        if (!read_byte(&frame[3+i])) {
+            return false;
+        }
+    }
+    return crc_crc8(frame, 3+len) == frame[3+len];
+}
+
+/*
+  receive a firmware image, then reset to let the bootloader apply
+  it. This does not return
+ */
+void uartfw_load(void)
+{
+    printf("UART firmware load at %lu\n", (uint32_t)UARTFW_BAUDRATE);
+    uart2_flush();
+    uart2_set_baudrate(UARTFW_BAUDRATE);
+    uart2_enable_rx();
+
+    led_green_set(false);
+    led_yellow_set(true);
+
+    while (true) {
+        uint16_t offset;
+        uint8_t len;
+
+        if (!read_frame()) {
+            send_reply(UARTFW_NAK, 0);
+            continue;
+        }
+        offset = (((uint16_t)frame[0]) << 8) | frame[1];
+        len = frame[2];
+
+        if (len == 0) {
+            // end of transfer
+            if (image_valid()) {
+                send_reply(UARTFW_ACK, offset);
+                uart2_flush();
+                // activating the window watchdog with T6 clear resets
+                WWDG_CR = 0x80;
+            }
+            send_reply(UARTFW_NAK, offset);
+            continue;
+        }
+
+        // the sum offset+len can wrap in 16 bits, so don't add them
+        if ((offset % UARTFW_BLOCK_SIZE) != 0 ||
+            offset >= UARTFW_SLOT_SIZE ||
+            offset > UARTFW_SLOT_SIZE - len) {
+            send_reply(UARTFW_NAK, offset);
+            continue;
+        }
+
+        // pad a short final block
+        memset(&frame[3+len], 0xFF, UARTFW_BLOCK_SIZE-len);
+        flash_write_block(NEW_FIRMWARE_BASE + offset, &frame[3]);
+        led_yellow_toggle();
+        send_reply(UARTFW_ACK, offset);
+    }
+}
@@ -0,0 +1,132 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <config.h>
+#include <crc.h>
+#include <cypress.h>
+#include <telem_structure.h>
+#include <uplink.h>
+
+#if UPLINK_RECORDS
+
+/*
+  uplink record scheduler. Records are taken from three queues in
+  priority order: OTA acks and windowed transfer status, then link
+  stats, then build information. A new ack is sent UPLINK_ACK_REPEATS
+  times as a record is lost with its packet, and the current ack is
+  also repeated with the build information. Every UPLINK_LOW_SHARE'th
+  record comes from the lower queues, so a long transfer doesn't
+  starve them, and every UPLINK_STATIC_SHARE'th of those is from the
+  build information queue.
+
+  Called from packet building in the radio interrupt handlers only
+ */
+#define UPLINK_ACK_REPEATS 3
+#define UPLINK_LOW_SHARE 4
+#define UPLINK_STATIC_SHARE 8
+
+extern uint8_t telem_ack_value;
+extern uint8_t get_bl_version(void);
+
+static const uint8_t link_types[] = { TXTELEM_RSSI, TXTELEM_POWER, TXTELEM_NOISE };
+static const uint8_t static_types[] = { TXTELEM_ACK, TXTELEM_BUILD, TXTELEM_VERSION };
+
+static uint8_t last_ack_value;
+static uint8_t ack_repeats;
+static uint8_t urgent_count;
+static uint8_t low_count;
+static uint8_t link_idx;
+static uint8_t static_idx;
+
+// the record being sent, crc:type:data
+static uint32_t record;
+
+static uint16_t record_data(uint8_t type)
+{
+    switch (type) {
+    case TXTELEM_RSSI:
+        return (((uint16_t)get_telem_pps())<<8) | get_telem_rssi();
+    case TXTELEM_ACK:
+        return (((uint16_t)telem_ack_value)<<8) | get_fw_resume_block();
+    case TXTELEM_NOISE:
+        return (((uint16_t)get_noise_floor(1))<<8) | get_noise_floor(0);
+    case TXTELEM_POWER:
+        return (((uint16_t)get_link_loss())<<8) | get_tx_power();
+    case TXTELEM_BUILD:
+        return ((BUILD_DATE_YEAR-2017)<<9) | (BUILD_DATE_MONTH<<5) | BUILD_DATE_DAY;
+    case TXTELEM_VERSION:
+        return (((uint16_t)get_frame_profile())<<8) | get_bl_version();
+    }
+    return 0;
+}
+
+/*
+  get the next urgent record, returning false if there is none
+ */
+static bool next_urgent(uint8_t *type, uint16_t *data)
+{
+    uint8_t block;
+    uint16_t bitmap;
+
+    if (telem_ack_value != last_ack_value) {
+        last_ack_value = telem_ack_value;
+        ack_repeats = UPLINK_ACK_REPEATS;
+    }
+    if (ack_repeats != 0) {
+        ack_repeats--;
+        *type = TXTELEM_ACK;
+        *data = record_data(TXTELEM_ACK);
+        return true;
+    }
+    if (get_fw_window_bitmap(&block, &bitmap)) {
+        *type = TXTELEM_FW_WINDOW | block;
+        *data = bitmap;
+        return true;
+    }
+    return false;
+}
+
+/*
+  choose the record for the next packet that carries one
+ */
+void uplink_next_record(void)
+{
+    uint8_t type;
+    uint16_t data;
+    uint8_t buf[3];
+
+    if (urgent_count < UPLINK_LOW_SHARE-1 && next_urgent(&type, &data)) {
+        urgent_count++;
+    } else {
+        urgent_count = 0;
+        low_count = (low_count + 1) % UPLINK_STATIC_SHARE;
+        if (low_count == 0) {
+            type = static_types[static_idx];
+            static_idx = (static_idx + 1) % sizeof(static_types);
+        } else {
+            type = link_types[link_idx];
+            link_idx = (link_idx + 1) % sizeof(link_types);
+        }
+        data = record_data(type);
+    }
+
+    buf[0] = type;
+    buf[1] = data >> 8;
+    buf[2] = data & 0xFF;
+    record = (((uint32_t)(uint8_t)~crc_crc8(buf, 3))<<24) | (((uint32_t)type)<<16) | data;
+}
+
+/*
+  the 11 bit value of one of the record channels
+ */
+uint16_t uplink_channel_value(uint8_t chan)
+{
+    switch (chan) {
+    case UPLINK_FIRST_CHANNEL:
+        return record >> 21;
+    case UPLINK_FIRST_CHANNEL+1:
+        return (record >> 10) & 0x7FF;
+    }
+    return record & 0x3FF;
+}
+
+#endif // UPLINK_RECORDS
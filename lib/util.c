@@ -8,7 +8,9 @@
 void chip_init(void)
 {
     CLK_CKDIVR = CLOCK_DIV;
-    CLK_SPCKENR1 = 0xFF; // Enable all peripherals
+    // only clock the peripherals we use. ADC and AWU/beeper are in
+    // CLK_PCKENR2 and stay enabled from reset
+    CLK_SPCKENR1 = CLK_SPCKENR1_TIM2 | CLK_SPCKENR1_TIM4 | CLK_SPCKENR1_UART2 | CLK_SPCKENR1_SPI;
 
     // power button
     gpio_config(PIN_POWER, GPIO_OUTPUT_PUSHPULL|GPIO_SET);
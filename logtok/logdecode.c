@@ -0,0 +1,233 @@
+/*
+  decode the log of a LOG_TOKENS build back into text, using the
+  logtok.dict written by mklogtok for that build. See include/logtok.h
+
+  Reads from the serial port if one is given, otherwise from stdin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <logtok.h>
+
+#define LOG_BAUDRATE B57600
+#define MAX_LINE 600
+
+static char *formats[LOGTOK_MAX_IDS];
+
+static int open_serial(const char *path)
+{
+    int fd = open(path, O_RDONLY|O_NOCTTY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct termios t;
+    if (tcgetattr(fd, &t) != 0) {
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&t);
+    cfsetispeed(&t, LOG_BAUDRATE);
+    cfsetospeed(&t, LOG_BAUDRATE);
+    t.c_cflag |= CLOCAL | CREAD;
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    if (tcsetattr(fd, TCSANOW, &t) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+  next input byte, or -1 at the end of input
+ */
+static int get_byte(int fd)
+{
+    uint8_t c;
+    if (read(fd, &c, 1) != 1) {
+        return -1;
+    }
+    return c;
+}
+
+static int get_bytes(int fd, uint8_t n, uint32_t *v)
+{
+    *v = 0;
+    while (n--) {
+        int c = get_byte(fd);
+        if (c < 0) {
+            return -1;
+        }
+        *v = (*v << 8) | c;
+    }
+    return 0;
+}
+
+/*
+  convert the C escapes of a format as written in the source
+ */
+static void unescape(const char *in, char *out)
+{
+    while (*in) {
+        if (*in != '\\' || in[1] == 0) {
+            *out++ = *in++;
+            continue;
+        }
+        in++;
+        switch (*in) {
+        case 'n': *out++ = '\n'; in++; break;
+        case 'r': *out++ = '\r'; in++; break;
+        case 't': *out++ = '\t'; in++; break;
+        case 'x':
+            *out++ = (char)strtoul(in+1, (char **)&in, 16);
+            break;
+        case '0': case '1': case '2': case '3':
+        case '4': case '5': case '6': case '7': {
+            unsigned v = 0;
+            int i;
+            for (i=0; i<3 && *in >= '0' && *in <= '7'; i++) {
+                v = v*8 + (*in++ - '0');
+            }
+            *out++ = (char)v;
+            break;
+        }
+        default:
+            *out++ = *in++;
+            break;
+        }
+    }
+    *out = 0;
+}
+
+static void load_dict(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[MAX_LINE];
+
+    if (f == NULL) {
+        printf("failed to open %s\n", path);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char fmt[MAX_LINE];
+        unsigned index;
+        char *p;
+        if (line[0] == '#') {
+            continue;
+        }
+        line[strcspn(line, "\n")] = 0;
+        index = strtoul(line, &p, 16);
+        if (*p != ' ' || index >= LOGTOK_MAX_IDS) {
+            continue;
+        }
+        unescape(p+1, fmt);
+        formats[index] = strdup(fmt);
+    }
+    fclose(f);
+}
+
+/*
+  print one message, reading its arguments as the format needs them
+ */
+static int print_message(int fd, const char *fmt)
+{
+    for (; *fmt; fmt++) {
+        uint8_t size = 2;
+        uint32_t v;
+        if (*fmt != '%') {
+            putchar(*fmt);
+            continue;
+        }
+        fmt++;
+        if (*fmt == 'l') {
+            size = 4;
+            fmt++;
+        } else if (*fmt == 'h') {
+            size = 1;
+            fmt++;
+        }
+        if (*fmt == 's') {
+            int c;
+            while ((c = get_byte(fd)) > 0) {
+                putchar(c);
+            }
+            if (c < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (get_bytes(fd, size, &v) != 0) {
+            return -1;
+        }
+        switch (*fmt) {
+        case 'd':
+            if (size == 1) {
+                printf("%d", (int8_t)v);
+            } else if (size == 2) {
+                printf("%d", (int16_t)v);
+            } else {
+                printf("%ld", (long)(int32_t)v);
+            }
+            break;
+        case 'u':
+            printf("%lu", (unsigned long)v);
+            break;
+        case 'x':
+            printf("%lX", (unsigned long)v);
+            break;
+        case 'o':
+            printf("%lo", (unsigned long)v);
+            break;
+        case 'c':
+            putchar(v & 0xFF);
+            break;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    int fd = 0;
+
+    if (argc != 2 && argc != 3) {
+        printf("Usage: logdecode DICT [SERIAL]\n");
+        exit(1);
+    }
+    load_dict(argv[1]);
+    if (argc == 3) {
+        fd = open_serial(argv[2]);
+        if (fd == -1) {
+            printf("failed to open %s\n", argv[2]);
+            exit(1);
+        }
+    }
+
+    while (1) {
+        uint32_t id;
+        int c = get_byte(fd);
+        if (c < 0) {
+            break;
+        }
+        if (c != LOGTOK_SYNC) {
+            // text from outside the tokenized log
+            putchar(c);
+            continue;
+        }
+        if (get_bytes(fd, 2, &id) != 0) {
+            break;
+        }
+        if (formats[id & 0xFFF] == NULL) {
+            printf("<unknown message 0x%04x>\n", (unsigned)id);
+        } else if (print_message(fd, formats[id & 0xFFF]) != 0) {
+            break;
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,309 @@
+/*
+  replace the printf calls of the transmitter sources with log_token
+  calls at build time, and write the format strings to a dictionary
+  for logdecode. See include/logtok.h
+
+  Each SOURCE is written to OUTDIR/SOURCE. Calls whose format is not a
+  string literal are left as they are
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <logtok.h>
+
+#define MAX_FORMAT 512
+
+static char *formats[LOGTOK_MAX_IDS];
+static unsigned num_formats;
+
+static char *read_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    char *buf;
+    long len;
+
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(len+1);
+    if (buf == NULL || fread(buf, 1, len, f) != (size_t)len) {
+        fclose(f);
+        free(buf);
+        return NULL;
+    }
+    buf[len] = 0;
+    fclose(f);
+    return buf;
+}
+
+/*
+  create the directories leading to a file
+ */
+static void make_dirs(const char *path)
+{
+    char dir[256];
+    char *p;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (p=strchr(dir+1, '/'); p != NULL; p=strchr(p+1, '/')) {
+        *p = 0;
+        mkdir(dir, 0755);
+        *p = '/';
+    }
+}
+
+/*
+  get the argument spec of a format string, as it appears in the
+  source. Returns the number of arguments, or -1 for a conversion
+  printfl does not support
+ */
+static int parse_format(const char *fmt, uint32_t *spec)
+{
+    int nargs = 0;
+
+    *spec = 0;
+    for (; *fmt; fmt++) {
+        uint32_t type = LOGTOK_ARG_INT;
+        if (*fmt == '\\' && fmt[1]) {
+            fmt++;
+            continue;
+        }
+        if (*fmt != '%') {
+            continue;
+        }
+        fmt++;
+        if (*fmt == 'l') {
+            type = LOGTOK_ARG_LONG;
+            fmt++;
+        } else if (*fmt == 'h') {
+            type = LOGTOK_ARG_CHAR;
+            fmt++;
+        }
+        switch (*fmt) {
+        case 's':
+            type = LOGTOK_ARG_STR;
+            break;
+        case 'd':
+        case 'u':
+        case 'x':
+        case 'o':
+            break;
+        case 'c':
+            type = LOGTOK_ARG_INT;
+            break;
+        default:
+            return -1;
+        }
+        if (nargs == LOGTOK_MAX_ARGS) {
+            return -1;
+        }
+        *spec |= type << (2*nargs);
+        nargs++;
+    }
+    return nargs;
+}
+
+/*
+  dictionary index of a format, adding it if new. Returns -1 when the
+  dictionary is full
+ */
+static int format_index(const char *fmt)
+{
+    unsigned i;
+    for (i=0; i<num_formats; i++) {
+        if (strcmp(formats[i], fmt) == 0) {
+            return i;
+        }
+    }
+    if (num_formats == LOGTOK_MAX_IDS) {
+        return -1;
+    }
+    formats[num_formats] = strdup(fmt);
+    return num_formats++;
+}
+
+static const char *skip_space(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+        p++;
+    }
+    return p;
+}
+
+/*
+  end of a string or character literal starting at p
+ */
+static const char *skip_literal(const char *p)
+{
+    char quote = *p++;
+    while (*p && *p != quote) {
+        if (*p == '\\' && p[1]) {
+            p++;
+        }
+        p++;
+    }
+    return *p ? p+1 : p;
+}
+
+/*
+  parse the arguments of a printf call from the opening bracket,
+  collecting the format from one or more adjacent string literals.
+  Returns the position of the comma or bracket after the format, or
+  NULL if the format is not a string literal
+ */
+static const char *parse_call(const char *p, char *fmt)
+{
+    size_t len = 0;
+
+    p = skip_space(p);
+    if (*p != '(') {
+        return NULL;
+    }
+    p = skip_space(p+1);
+    if (*p != '"') {
+        return NULL;
+    }
+    while (*p == '"') {
+        const char *end = skip_literal(p);
+        size_t n = (end - p) - 2;
+        if (len + n >= MAX_FORMAT) {
+            return NULL;
+        }
+        memcpy(&fmt[len], p+1, n);
+        len += n;
+        p = skip_space(end);
+    }
+    fmt[len] = 0;
+    if (*p != ',' && *p != ')') {
+        return NULL;
+    }
+    return p;
+}
+
+static unsigned line_of(const char *src, const char *p)
+{
+    unsigned line = 1;
+    while (src < p) {
+        if (*src++ == '\n') {
+            line++;
+        }
+    }
+    return line;
+}
+
+static bool is_ident(char c)
+{
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+/*
+  copy a source, replacing printf calls. Newlines inside a replaced
+  part of a call are kept so line numbers still match the original
+ */
+static bool rewrite(const char *path, const char *src, FILE *out)
+{
+    const char *p = src;
+
+    while (*p) {
+        if (p[0] == '/' && p[1] == '*') {
+            const char *end = strstr(p+2, "*/");
+            end = end ? end+2 : p+strlen(p);
+            fwrite(p, 1, end-p, out);
+            p = end;
+        } else if (p[0] == '/' && p[1] == '/') {
+            const char *end = strchr(p, '\n');
+            end = end ? end : p+strlen(p);
+            fwrite(p, 1, end-p, out);
+            p = end;
+        } else if (*p == '"' || *p == '\'') {
+            const char *end = skip_literal(p);
+            fwrite(p, 1, end-p, out);
+            p = end;
+        } else if (is_ident(*p)) {
+            const char *start = p;
+            char fmt[MAX_FORMAT];
+            const char *end;
+            while (is_ident(*p)) {
+                p++;
+            }
+            if (p - start != 6 || strncmp(start, "printf", 6) != 0 ||
+                (end = parse_call(p, fmt)) == NULL) {
+                fwrite(start, 1, p-start, out);
+                continue;
+            }
+            uint32_t spec;
+            int nargs = parse_format(fmt, &spec);
+            int index = format_index(fmt);
+            if (nargs < 0 || index < 0) {
+                fprintf(stderr, "%s:%u: can't tokenize printf(\"%s\")\n",
+                        path, line_of(src, start), fmt);
+                return false;
+            }
+            fprintf(out, "log_token(0x%04xU, 0x%08lxUL", LOGTOK_ID(index, nargs), (unsigned long)spec);
+            for (; p < end; p++) {
+                if (*p == '\n') {
+                    fputc('\n', out);
+                }
+            }
+        } else {
+            fputc(*p++, out);
+        }
+    }
+    return true;
+}
+
+int main(int argc, const char *argv[])
+{
+    FILE *f_dict;
+    unsigned i;
+    int a;
+
+    if (argc < 4) {
+        printf("Usage: mklogtok OUTDIR DICT SOURCE...\n");
+        exit(1);
+    }
+
+    for (a=3; a<argc; a++) {
+        char path[256];
+        char *src = read_file(argv[a]);
+        FILE *out;
+        if (src == NULL) {
+            printf("failed to read %s\n", argv[a]);
+            exit(1);
+        }
+        snprintf(path, sizeof(path), "%s/%s", argv[1], argv[a]);
+        make_dirs(path);
+        out = fopen(path, "w");
+        if (out == NULL) {
+            printf("failed to open %s\n", path);
+            exit(1);
+        }
+        if (!rewrite(argv[a], src, out)) {
+            fclose(out);
+            remove(path);
+            exit(1);
+        }
+        fclose(out);
+        free(src);
+    }
+
+    f_dict = fopen(argv[2], "w");
+    if (f_dict == NULL) {
+        printf("failed to open %s\n", argv[2]);
+        exit(1);
+    }
+    fprintf(f_dict, "# LOG_TOKENS message formats, generated by mklogtok, do not edit\n");
+    for (i=0; i<num_formats; i++) {
+        fprintf(f_dict, "%03x %s\n", i, formats[i]);
+    }
+    fclose(f_dict);
+    printf("%u message formats\n", num_formats);
+    return 0;
+}
@@ -4,6 +4,10 @@
 #include "gpio.h"
 #include "config.h"
 
+INTERRUPT_HANDLER(UART2_TX_IRQHandler, 20) {
+    uart2_tx_irq();
+}
+
 static uint16_t pins[] = {
     LED_GREEN,
     LED_YELLOW,
@@ -23,6 +27,8 @@ int main()
 
     chip_init();
     uart2_init();
+    // uart output is sent from the TX interrupt
+    enableInterrupts();
     printf("pintest start\n");
     delay_ms(1);
 
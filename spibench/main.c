@@ -0,0 +1,254 @@
+/*
+  SPI and radio throughput benchmark
+
+  Times register reads, burst writes and reads and a queued packet
+  write to the CYRF6936 at every SPI clock the STM8 supports, checking
+  that registers read back correctly at each speed. The speeds that
+  pass are then used for a second of normal sending to time
+  send_normal_packet() from the radio timer slot. Results are printed
+  over UART as a table
+ */
+#include "stm8l.h"
+#include "util.h"
+#include "uart.h"
+#include "spi.h"
+#include "gpio.h"
+#include "timer.h"
+#include "cypress.h"
+#include "config.h"
+#include <string.h>
+
+INTERRUPT_HANDLER(EXTI_PORTC_IRQHandler, 5) {
+    cypress_irq();
+}
+INTERRUPT_HANDLER(SPI_IRQHandler, 10) {
+    spi_irq();
+}
+INTERRUPT_HANDLER(UART2_TX_IRQHandler, 20) {
+    uart2_tx_irq();
+}
+INTERRUPT_HANDLER(TIM4_UPD_OVF_IRQHandler, 23) {
+    timer_irq();
+}
+INTERRUPT_HANDLER(TIM2_UPD_OVF_IRQHandler, 13) {
+    timer2_irq();
+}
+INTERRUPT_HANDLER(TIM2_CAP_COM_IRQHandler, 14) {
+    timer2_irq();
+}
+
+/*
+  used by the channel 8 extra data, which is not looked at here
+ */
+uint8_t get_bl_version(void)
+{
+    return 0;
+}
+
+// CYRF6936 registers used by the benchmark
+#define REG_TX_LENGTH     0x01
+#define REG_TX_CTRL       0x02
+#define REG_TX_IRQ_STATUS 0x04
+#define REG_CRC_SEED_LSB  0x15
+#define REG_TX_BUFFER     0x20
+#define REG_RX_BUFFER     0x21
+#define REG_SOP_CODE      0x22
+#define REG_DATA_CODE     0x23
+#define FLAG_WRITE        0x80
+#define TX_CLR            0x40
+
+// the radio is rated for a 4MHz SPI clock, but try them all
+#define NUM_SPEEDS 8
+
+// operations per timing
+#define BENCH_LOOPS 64
+
+// master clock and the SPI_CR1 clock divider set by spi_init()
+#if CLOCK_DIV == CLOCK_DIV_16MHZ
+#define MASTER_HZ 16000000UL
+#define DEFAULT_CLOCK_DIV 3
+#else
+#define MASTER_HZ 2000000UL
+#define DEFAULT_CLOCK_DIV 1
+#endif
+
+static uint8_t read_reg(uint8_t reg)
+{
+    uint8_t d[2] = { reg, 0 };
+    spi_transfer(2, d, d);
+    return d[1];
+}
+
+static void write_reg(uint8_t reg, uint8_t value)
+{
+    uint8_t d[2] = { reg | FLAG_WRITE, value };
+    spi_write(2, d);
+}
+
+/*
+  write and read back registers, returning the number of mismatches
+ */
+static uint8_t check_registers(void)
+{
+    uint8_t errors = 0;
+    uint8_t pattern[16];
+    uint8_t buf[16];
+    uint8_t i;
+
+    for (i=0; i<32; i++) {
+        uint8_t v = i*37 + 11;
+        write_reg(REG_CRC_SEED_LSB, v);
+        if (read_reg(REG_CRC_SEED_LSB) != v) {
+            errors++;
+        }
+    }
+    for (i=0; i<16; i++) {
+        pattern[i] = (i*29) ^ 0xA5;
+    }
+    write_multiple(REG_SOP_CODE, 8, pattern);
+    spi_read_registers(REG_SOP_CODE, buf, 8);
+    for (i=0; i<8; i++) {
+        if (buf[i] != pattern[i]) {
+            errors++;
+        }
+    }
+    write_multiple(REG_DATA_CODE, 16, pattern);
+    spi_read_registers(REG_DATA_CODE, buf, 16);
+    for (i=0; i<16; i++) {
+        if (buf[i] != pattern[i]) {
+            errors++;
+        }
+    }
+    return errors;
+}
+
+/*
+  print a time for BENCH_LOOPS operations as microseconds per operation
+  with one decimal place
+ */
+static void print_time(uint32_t total_us)
+{
+    uint32_t t10 = (total_us * 10) / BENCH_LOOPS;
+    printf(" %lu.%lu", t10 / 10, t10 % 10);
+}
+
+static uint8_t tx_data[16];
+
+/*
+  the packet setup writes of a send, without starting the transmit
+ */
+static const struct spi_write packet_writes[] = {
+    { REG_TX_LENGTH, 1, 16, NULL },
+    { REG_TX_CTRL, 1, TX_CLR, NULL },
+    { REG_TX_BUFFER, 16, 0, tx_data },
+    { REG_TX_IRQ_STATUS, 1, 0, NULL },
+};
+
+/*
+  time the SPI operations at one clock speed, returning the number of
+  register mismatches
+ */
+static uint8_t bench_speed(uint8_t br)
+{
+    uint8_t buf[16];
+    uint8_t errors;
+    uint16_t i;
+    uint32_t t0;
+
+    spi_set_clock_div(br);
+    printf("%lu", MASTER_HZ >> (br+1));
+
+    errors = check_registers();
+    printf(" %u", errors);
+
+    t0 = micros();
+    for (i=0; i<BENCH_LOOPS; i++) {
+        read_reg(REG_CRC_SEED_LSB);
+    }
+    print_time(micros() - t0);
+
+    t0 = micros();
+    for (i=0; i<BENCH_LOOPS; i++) {
+        write_multiple(REG_TX_BUFFER, 16, tx_data);
+    }
+    print_time(micros() - t0);
+
+    t0 = micros();
+    for (i=0; i<BENCH_LOOPS; i++) {
+        spi_read_registers(REG_RX_BUFFER, buf, 16);
+    }
+    print_time(micros() - t0);
+
+    t0 = micros();
+    for (i=0; i<BENCH_LOOPS; i++) {
+        spi_queue_start(packet_writes, ARRAY_SIZE(packet_writes), NULL);
+        while (spi_queue_busy()) ;
+    }
+    print_time(micros() - t0);
+
+    printf("\n");
+    return errors;
+}
+
+/*
+  run normal sending for a second and report the radio slot timing
+ */
+static void bench_send(uint8_t br)
+{
+    struct timer_stats *stats = timer_get_stats(TIMER_SLOT_RADIO);
+
+    spi_set_clock_div(br);
+    cypress_start_send(true);
+    memset(stats, 0, sizeof(*stats));
+    delay_ms(1000);
+
+    timer_cancel(TIMER_SLOT_RADIO);
+    delay_ms(20);
+    timer_cancel(TIMER_SLOT_NOISE);
+    spi_queue_wait();
+
+    printf("%lu %u %u %u\n", MASTER_HZ >> (br+1),
+           stats->calls, stats->max_run_us, stats->max_late_us);
+}
+
+void main(void)
+{
+    uint8_t errors[NUM_SPEEDS];
+    uint8_t br;
+
+    chip_init();
+    led_init();
+    spi_init();
+    timer_init();
+    uart2_init();
+    cypress_init();
+
+    EXTI_CR1 = (1<<6) | (1<<4) | (1<<2) | (1<<0); // rising edge interrupts
+
+    enableInterrupts();
+
+    printf("spibench start\n");
+    printf("SCK_HZ ERR READ_US WRITE16_US READ16_US QUEUE_US\n");
+    for (br=0; br<NUM_SPEEDS; br++) {
+        errors[br] = bench_speed(br);
+    }
+
+    // a failed speed may have left junk in the radio registers
+    spi_set_clock_div(DEFAULT_CLOCK_DIV);
+    cypress_init();
+
+    // slowest first
+    printf("SCK_HZ SENDS SEND_US LATE_US\n");
+    for (br=NUM_SPEEDS; br-- > 0; ) {
+        if (errors[br] == 0) {
+            bench_send(br);
+        }
+    }
+    spi_set_clock_div(DEFAULT_CLOCK_DIV);
+
+    printf("spibench done\n");
+    while (true) {
+        led_green_toggle();
+        delay_ms(500);
+    }
+}
@@ -0,0 +1,82 @@
+/*
+  convert the built in RTTTL tunes into note tables at build time, so
+  the transmitter does not need to parse them
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rtttl.h>
+
+#define MAX_LINE 256
+#define MAX_TUNES 32
+
+int main(int argc, const char *argv[])
+{
+    FILE *f_in, *f_out;
+    char line[MAX_LINE];
+    struct rtttl_note notes[MAX_LINE/2];
+    char names[MAX_TUNES][MAX_LINE];
+    uint8_t num_notes[MAX_TUNES];
+    unsigned num_tunes = 0;
+    unsigned i;
+
+    if (argc != 3) {
+        printf("Usage: mktunes TUNES.txt OUTPUT.h\n");
+        exit(1);
+    }
+    f_in = fopen(argv[1], "r");
+    if (f_in == NULL) {
+        printf("failed to open %s\n", argv[1]);
+        exit(1);
+    }
+    f_out = fopen(argv[2], "w");
+    if (f_out == NULL) {
+        printf("failed to open %s\n", argv[2]);
+        exit(1);
+    }
+
+    fprintf(f_out, "/* generated from %s by mktunes, do not edit */\n\n", argv[1]);
+
+    while (fgets(line, sizeof(line), f_in) != NULL) {
+        char *colon;
+        uint8_t n;
+
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == '#' || line[0] == 0) {
+            continue;
+        }
+        colon = strchr(line, ':');
+        if (colon == NULL || num_tunes == MAX_TUNES) {
+            printf("bad tune '%s'\n", line);
+            exit(1);
+        }
+        n = rtttl_parse(line, notes, sizeof(notes)/sizeof(notes[0]));
+        if (n == 0) {
+            printf("no notes in tune '%s'\n", line);
+            exit(1);
+        }
+        *colon = 0;
+        strcpy(names[num_tunes], line);
+        num_notes[num_tunes] = n;
+
+        fprintf(f_out, "static const struct rtttl_note tune%u_notes[%u] = {\n", num_tunes, n);
+        for (i=0; i<n; i++) {
+            fprintf(f_out, "    { %u, %u },\n", notes[i].note, notes[i].duration_ms);
+        }
+        fprintf(f_out, "};\n\n");
+        num_tunes++;
+    }
+
+    fprintf(f_out, "#define NUM_BUILTIN_TUNES %u\n\n", num_tunes);
+    fprintf(f_out, "static const struct rtttl_tune builtin_tunes[NUM_BUILTIN_TUNES] = {\n");
+    for (i=0; i<num_tunes; i++) {
+        fprintf(f_out, "    { \"%s\", tune%u_notes, %u },\n", names[i], i, num_notes[i]);
+    }
+    fprintf(f_out, "};\n");
+
+    fclose(f_in);
+    fclose(f_out);
+    printf("converted %u tunes\n", num_tunes);
+    return 0;
+}
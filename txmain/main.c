@@ -14,6 +14,10 @@
 #include "config.h"
 #include "channels.h"
 #include "telem_structure.h"
+#include "uartfw.h"
+#include "perf.h"
+#include "settings.h"
+#include "buttons.h"
 #include <string.h>
 
 /*
@@ -21,13 +25,31 @@
  */
 
 INTERRUPT_HANDLER(ADC1_IRQHandler, 22) {
+    PERF_BEGIN(PERF_ADC_IRQ);
     adc_irq();
+    PERF_END(PERF_ADC_IRQ);
 }
 INTERRUPT_HANDLER(EXTI_PORTC_IRQHandler, 5) {
+    PERF_BEGIN(PERF_RADIO_IRQ);
     cypress_irq();
+    PERF_END(PERF_RADIO_IRQ);
+}
+INTERRUPT_HANDLER(SPI_IRQHandler, 10) {
+    spi_irq();
+}
+INTERRUPT_HANDLER(UART2_TX_IRQHandler, 20) {
+    uart2_tx_irq();
 }
 INTERRUPT_HANDLER(TIM4_UPD_OVF_IRQHandler, 23) {
+    PERF_BEGIN(PERF_TICK_IRQ);
     timer_irq();
+    PERF_END(PERF_TICK_IRQ);
+}
+INTERRUPT_HANDLER(TIM2_UPD_OVF_IRQHandler, 13) {
+    timer2_irq();
+}
+INTERRUPT_HANDLER(TIM2_CAP_COM_IRQHandler, 14) {
+    timer2_irq();
 }
 
 // get buttons without power button
@@ -66,6 +88,15 @@ static struct telem_status last_status;
 static uint8_t last_mode;
 extern uint8_t note_adjust;
 
+// the idle loop does timed work once per 1ms tick
+static uint32_t last_tick_ms;
+
+// stick and button activity is checked this often. This includes the
+// hold power to power off path, so it runs from the main loop, by
+// elapsed time so a slow loop pass doesn't skip a check
+#define STICK_CHECK_MS 16
+static uint32_t last_stick_check_ms;
+
 /*
   update led flashing
  */
@@ -90,11 +121,7 @@ static void check_stick_activity(void)
         }
     }
     // any button counts as activity
-    if ((gpio_get(PIN_RIGHT_BUTTON)==0) ||
-        (gpio_get(PIN_LEFT_BUTTON)==0) ||
-        (gpio_get(PIN_SW1)==0) ||
-        (gpio_get(PIN_SW2)==0) ||
-        (gpio_get(PIN_USER)!=0)) {
+    if (get_buttons() != 0) {
         active = true;
     }
     if (active) {
@@ -102,6 +129,10 @@ static void check_stick_activity(void)
     }
 
     if (power_off_disarm) {
+        // the power button is being held, so save settings before
+        // the power goes
+        settings_flush();
+
         // if the user holds down power button for
         // POWER_OFF_DISARMED_MS and the vehicle is disarmed then
         // power off
@@ -110,7 +141,8 @@ static void check_stick_activity(void)
             printf("power off disarmed\n");
             gpio_clear(PIN_POWER);
             disableInterrupts();
-            buzzer_tune(TONE_ERROR_TUNE);
+            uart2_flush();
+            buzzer_tune_blocking(TONE_ERROR_TUNE);
             // loop forever
             while (true) ;
         }
@@ -177,7 +209,7 @@ static void status_update(bool have_link)
             FCC_power = get_FCC_power();
             printf("FCC power %u\n", FCC_power);
             for (i=0; i<FCC_power; i++) {
-                buzzer_tune(TONE_RX_SEARCH);
+                buzzer_tune_blocking(TONE_RX_SEARCH);
                 delay_ms(100);
             }
         }
@@ -222,6 +254,7 @@ static void status_update(bool have_link)
         if (time_since_activity_s > 180) {
             // clear power control
             printf("powering off\n");
+            settings_flush();
             gpio_clear(PIN_POWER);            
         }
         if (time_since_activity_s > 170) {
@@ -324,12 +357,12 @@ static void status_update(bool have_link)
 
     // remember wifi chan
     if (t_status.wifi_chan != last_status.wifi_chan) {
-        eeprom_write(EEPROM_WIFICHAN_OFFSET, t_status.wifi_chan);
+        settings_set(EEPROM_WIFICHAN_OFFSET, t_status.wifi_chan);
     }
 
     // remember tx power
     if (t_status.tx_max != last_status.tx_max) {
-        eeprom_write(EEPROM_TXMAX, t_status.tx_max);
+        settings_set(EEPROM_TXMAX, t_status.tx_max);
     }
 
     // remember note adjust
@@ -338,7 +371,7 @@ static void status_update(bool have_link)
         if (note_adjust > 40) {
             note_adjust = 40;
         }
-        eeprom_write(EEPROM_NOTE_ADJUST, note_adjust);
+        settings_set(EEPROM_NOTE_ADJUST, note_adjust);
     }
     
     memcpy(&last_status, &t_status, sizeof(t_status));
@@ -349,9 +382,13 @@ void main(void)
     uint16_t counter=0;
     uint32_t next_ms;
     uint8_t factory_mode = 0;
+    bool boot_reported = false;
     
     chip_init();
     led_init();
+#if PERF_STATS
+    perf_init();
+#endif
 
     // give indication of power on quickly for user
     led_yellow_set(true);
@@ -362,9 +399,11 @@ void main(void)
 
     delay_ms(1);
     uart2_init();
+    settings_init();
     cypress_init();
 
     buzzer_init();
+    channels_init();
     
     EXTI_CR1 = (1<<6) | (1<<4) | (1<<2) | (1<<0); // rising edge interrupts
 
@@ -373,7 +412,13 @@ void main(void)
     printf("BL_VERSION %u\n", get_bl_version());
     
     // wait for initial stick inputs
+#if FAST_BOOT
+    delay_ms(FAST_BOOT_INPUT_MS);
+#else
     delay_ms(200);
+#endif
+
+    cypress_set_frame_profile(settings_get(EEPROM_FRAME_PROFILE));
 
     switch (get_buttons_no_power()) {
     case BUTTON_LEFT | BUTTON_RIGHT:
@@ -383,14 +428,16 @@ void main(void)
         
     case BUTTON_LEFT:
         printf("DSM2 bind\n");
-        eeprom_write(EEPROM_DSMPROT_OFFSET, 1);
+        settings_set(EEPROM_DSMPROT_OFFSET, 1);
+        settings_flush();
         cypress_start_bind_send(true);
         break;
 
 #if SUPPORT_DSMX
     case BUTTON_RIGHT:
         printf("DSMX bind\n");
-        eeprom_write(EEPROM_DSMPROT_OFFSET, 0);
+        settings_set(EEPROM_DSMPROT_OFFSET, 0);
+        settings_flush();
         cypress_start_bind_send(false);
         break;
 #endif
@@ -422,15 +469,31 @@ void main(void)
         cypress_start_factory_test(factory_mode);
         break;
     }
+
+    case BUTTON_RIGHT_SHOULDER:
+        uartfw_load();
+        break;
+
+    case BUTTON_LEFT_SHOULDER | BUTTON_RIGHT_SHOULDER: {
+        // step to the next frame rate profile and keep it
+        bool use_dsm2 = settings_get(EEPROM_DSMPROT_OFFSET);
+        uint8_t profile = (get_frame_profile() + 1) % DSM_FRAME_NUM_PROFILES;
+        settings_set(EEPROM_FRAME_PROFILE, profile);
+        settings_flush();
+        cypress_set_frame_profile(profile);
+        printf("Frame profile %u\n", profile);
+        cypress_start_send(use_dsm2);
+        break;
+    }
         
     default: {
-        bool use_dsm2 = eeprom_read(EEPROM_DSMPROT_OFFSET);
+        bool use_dsm2 = settings_get(EEPROM_DSMPROT_OFFSET);
         cypress_start_send(use_dsm2);
         break;
     }
     }
 
-    note_adjust = eeprom_read(EEPROM_NOTE_ADJUST);
+    note_adjust = settings_get(EEPROM_NOTE_ADJUST);
     if (note_adjust > 40) {
         note_adjust = 20;
     }
@@ -445,16 +508,45 @@ void main(void)
 
     while (true) {
         uint8_t telem_pps;
+        uint16_t max_late_us;
         bool link_ok = false;
         int8_t FCC_chan = get_FCC_chan();
 
         cypress_set_pps_rssi();
 
         telem_pps = get_telem_pps();
+
+        if (!boot_reported && get_first_send_ms() != 0) {
+            // boot time, tracked for FAST_BOOT
+            printf("Boot: first packet at %lu ms\n", get_first_send_ms());
+            boot_reported = true;
+        }
         
-        printf("%u: ADC=[%u %u %u %u] B:0x%x PWR:%u",
+        // report worst radio timer lateness since the last status line
+        __critical {
+            max_late_us = timer_get_stats(TIMER_SLOT_RADIO)->max_late_us;
+            timer_get_stats(TIMER_SLOT_RADIO)->max_late_us = 0;
+        }
+        printf("%u: ADC=[%u %u %u %u] B:0x%x PWR:%u LOSS:%u LR:%u LATE:%u NF:%u/%u",
                counter++, adc_value(0), adc_value(1), adc_value(2), adc_value(3),
-               (unsigned)get_buttons(), get_tx_power());
+               (unsigned)get_buttons(), get_tx_power(), get_link_loss(), get_link_rssi(),
+               max_late_us,
+               get_noise_floor(0), get_noise_floor(1));
+        if (uart2_tx_dropped() != 0) {
+            printf(" DROP:%u", uart2_tx_dropped());
+        }
+        if (get_telem_overflow() != 0) {
+            printf(" TQ:%u", get_telem_overflow());
+        }
+        if (get_write_queue_overflow() != 0) {
+            printf(" WQ:%u", get_write_queue_overflow());
+        }
+#if IDLE_STATS
+        printf(" IDLE:%u", timer_idle_percent());
+#endif
+#if PERF_STATS
+        printf(" JIT:%u", perf_max_us(PERF_SEND_JITTER));
+#endif
         if (FCC_chan != -1) {
             printf(" FCC %d CW:%u\n", FCC_chan, fcc_CW_mode);
         } else if (telem_pps == 0) {
@@ -473,10 +565,25 @@ void main(void)
         }
 
         status_update(link_ok);
+#if PERF_STATS
+        perf_report();
+#endif
         
         while (timer_get_ms() < next_ms) {
-            update_leds();
-            check_stick_activity();
+            uint32_t now = timer_get_ms();
+            if (now != last_tick_ms) {
+                last_tick_ms = now;
+                update_leds();
+                if (now - last_stick_check_ms >= STICK_CHECK_MS) {
+                    last_stick_check_ms = now;
+                    check_stick_activity();
+                }
+            }
+            cypress_process_telem();
+            cypress_flush_firmware();
+            settings_update();
+            // sleep until the next tick, ADC scan or radio interrupt
+            timer_idle();
         }
         if (FCC_chan != -1) {
             next_ms += 400;